@@ -38,43 +38,118 @@
 int b_init(hfsvol *vol)
 {
   bcache *cache;
-  int i;
+  unsigned int size, hashsz, ramax, i;
 
   ASSERT(vol->cache == 0);
 
+  /* determine cache geometry; keep hash chains to about 8 headers */
+
+  size = vol->opts.cachesz >> HFS_BLOCKSZ_BITS;
+
+  if (size == 0)
+    size = HFS_CACHESZ;
+  else if (size < (HFS_BLOCKBUFSZ << 2))
+    size = HFS_BLOCKBUFSZ << 2;
+
+  for (hashsz = HFS_HASHSZ; hashsz < (size >> 2); hashsz <<= 1)
+    continue;
+
+  /* read-ahead may not occupy more than a quarter of the cache */
+
+  ramax = vol->opts.ramax >> HFS_BLOCKSZ_BITS;
+
+  if (ramax == 0)
+    ramax = HFS_RAMAX;
+  if (ramax > (size >> 2))
+    ramax = size >> 2;
+  if (ramax < (HFS_BLOCKBUFSZ >> 1))
+    ramax = HFS_BLOCKBUFSZ >> 1;
+
   cache = ALLOC(bcache, 1);
   if (cache == 0)
     ERROR(ENOMEM, 0);
 
+  cache->chain = ALLOC(bucket, size << 1);
+  cache->hash  = ALLOC(bucket *, hashsz);
+  cache->list  = ALLOC(bucket *, size);
+  cache->ahead = ALLOC(bucket *, ramax);
+  cache->bufs  = ALLOC(block *, size);
+  cache->spare = ALLOC(block *, size);
+  cache->pool  = ALLOC(block, size);
+
+  if (cache->chain == 0 || cache->hash  == 0 || cache->list == 0 ||
+      cache->ahead == 0 || cache->bufs  == 0 ||
+      cache->spare == 0 || cache->pool  == 0)
+    {
+      FREE(cache->chain);
+      FREE(cache->hash);
+      FREE(cache->list);
+      FREE(cache->ahead);
+      FREE(cache->bufs);
+      FREE(cache->spare);
+      FREE(cache->pool);
+      FREE(cache);
+
+      ERROR(ENOMEM, 0);
+    }
+
   vol->cache = cache;
 
   cache->vol    = vol;
-  cache->tail   = &cache->chain[HFS_CACHESZ - 1];
+
+  cache->size   = size;
+  cache->hashsz = hashsz;
+  cache->target = 0;
+
+  for (i = 0; i < 4; ++i)
+    {
+      cache->head[i] = 0;
+      cache->len[i]  = 0;
+    }
+
+  cache->last   = 0;
+
+  cache->ramax  = ramax;
+  cache->rawin  = HFS_BLOCKBUFSZ >> 1;
+  cache->ranext = 0;
 
   cache->hits   = 0;
   cache->misses = 0;
 
-  for (i = 0; i < HFS_CACHESZ; ++i)
+  /* all bucket headers start out unused */
+
+  cache->free   = 0;
+  cache->dirty  = 0;
+  cache->ndirty = 0;
+
+  for (i = 0; i < (size << 1); ++i)
     {
       bucket *b = &cache->chain[i];
 
       b->flags = 0;
-      b->count = 0;
+      b->list  = HFS_ARC_FREE;
 
       b->bnum  = 0;
-      b->data  = &cache->pool[i];
+      b->data  = 0;
 
-      b->cnext = b + 1;
-      b->cprev = b - 1;
+      b->cnext = cache->free;
+      b->cprev = 0;
 
       b->hnext = 0;
       b->hprev = 0;
+
+      b->dnext = 0;
+      b->dprev = 0;
+
+      cache->free = b;
     }
 
-  cache->chain[0].cprev = cache->tail;
-  cache->tail->cnext    = &cache->chain[0];
+  for (i = 0; i < size; ++i)
+    cache->spare[i] = &cache->pool[i];
+
+  cache->nspare = size;
 
-  for (i = 0; i < HFS_HASHSZ; ++i)
+  for (i = 0; i < hashsz; ++i)
     cache->hash[i] = 0;
 
   return 0;
@@ -101,44 +176,42 @@ void b_showstats(const bcache *cache)
  */
 void b_dumpcache(const bcache *cache)
 {
+  static const char *names[] = { "T1", "T2", "B1", "B2" };
   const bucket *b;
-  int i;
+  unsigned int i, j;
 
-  fprintf(stderr, "BLOCK CACHE DUMP:\n");
+  fprintf(stderr, "BLOCK CACHE DUMP: target %u\n", cache->target);
 
-  for (i = 0, b = cache->tail->cnext; i < HFS_CACHESZ; ++i, b = b->cnext)
+  for (i = 0; i < 4; ++i)
     {
-      if (INUSE(b))
+      fprintf(stderr, "  %s[%u]:", names[i], cache->len[i]);
+
+      for (j = 0, b = cache->head[i]; j < cache->len[i]; ++j, b = b->cnext)
 	{
-	  fprintf(stderr, "\t %lu", b->bnum);
+	  fprintf(stderr, " %lu", b->bnum);
 	  if (DIRTY(b))
 	    fprintf(stderr, "*");
-
-	  fprintf(stderr, ":%u", b->count);
 	}
-    }
 
-  fprintf(stderr, "\n");
+      fprintf(stderr, "\n");
+    }
 
   fprintf(stderr, "BLOCK HASH DUMP:\n");
 
-  for (i = 0; i < HFS_HASHSZ; ++i)
+  for (i = 0; i < cache->hashsz; ++i)
     {
       int seen = 0;
 
       for (b = cache->hash[i]; b; b = b->hnext)
 	{
 	  if (! seen)
-	    fprintf(stderr, "  %d:", i);
-
-	  if (INUSE(b))
-	    {
-	      fprintf(stderr, " %lu", b->bnum);
-	      if (DIRTY(b))
-		fprintf(stderr, "*");
+	    fprintf(stderr, "  %u:", i);
 
-	      fprintf(stderr, ":%u", b->count);
-	    }
+	  fprintf(stderr, " %lu", b->bnum);
+	  if (b->data == 0)
+	    fprintf(stderr, "~");
+	  else if (DIRTY(b))
+	    fprintf(stderr, "*");
 
 	  seen = 1;
 	}
@@ -149,6 +222,106 @@ void b_dumpcache(const bcache *cache)
 }
 # endif
 
+/*
+ * NAME:	readvec()
+ * DESCRIPTION:	read consecutive physical blocks into separate buffers
+ */
+static
+int readvec(hfsvol *vol, unsigned long bnum,
+	    block *const *bufs, unsigned int blen)
+{
+  unsigned long nblocks;
+
+# ifdef DEBUG
+  fprintf(stderr, "BLOCK: READV vol 0x%lx block %lu+%u[..%lu]\n",
+	  (unsigned long) vol, bnum, blen - 1, bnum + blen - 1);
+# endif
+
+  nblocks = os_readv(&vol->priv, bufs, blen, bnum);
+  if (nblocks == (unsigned long) -1)
+    goto fail;
+
+  if (nblocks != blen)
+    ERROR(EIO, "incomplete block read");
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	writevec()
+ * DESCRIPTION:	write separate buffers to consecutive physical blocks
+ */
+static
+int writevec(hfsvol *vol, unsigned long bnum,
+	     const block *const *bufs, unsigned int blen)
+{
+  unsigned long nblocks;
+
+# ifdef DEBUG
+  fprintf(stderr, "BLOCK: WRITEV vol 0x%lx block %lu+%u[..%lu]\n",
+	  (unsigned long) vol, bnum, blen - 1, bnum + blen - 1);
+# endif
+
+  nblocks = os_writev(&vol->priv, bufs, blen, bnum);
+  if (nblocks == (unsigned long) -1)
+    goto fail;
+
+  if (nblocks != blen)
+    ERROR(EIO, "incomplete block write");
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	mkdirty()
+ * DESCRIPTION:	mark a resident bucket as needing to be written back
+ */
+static
+void mkdirty(bcache *cache, bucket *b)
+{
+  if (DIRTY(b))
+    return;
+
+  b->flags |= HFS_BUCKET_DIRTY;
+
+  b->dprev = &cache->dirty;
+  b->dnext = cache->dirty;
+
+  if (cache->dirty)
+    cache->dirty->dprev = &b->dnext;
+
+  cache->dirty = b;
+  ++cache->ndirty;
+}
+
+/*
+ * NAME:	mkclean()
+ * DESCRIPTION:	mark a bucket as identical to the medium
+ */
+static
+void mkclean(bcache *cache, bucket *b)
+{
+  if (! DIRTY(b))
+    return;
+
+  b->flags &= ~HFS_BUCKET_DIRTY;
+
+  *b->dprev = b->dnext;
+  if (b->dnext)
+    b->dnext->dprev = b->dprev;
+
+  b->dnext = 0;
+  b->dprev = 0;
+
+  --cache->ndirty;
+}
+
 /*
  * NAME:	fillchain()
  * DESCRIPTION:	fill a chain of bucket buffers with a single read
@@ -156,12 +329,12 @@ void b_dumpcache(const bcache *cache)
 static
 int fillchain(hfsvol *vol, bucket **bptr, unsigned int *count)
 {
-  bucket *blist[HFS_BLOCKBUFSZ], **start = bptr;
+  block **bufs = vol->cache->bufs;
+  bucket **start = bptr, **first = 0;
   unsigned long bnum;
-  unsigned int len, i;
+  unsigned int len;
 
-  for (len = 0; len < HFS_BLOCKBUFSZ &&
-	 (unsigned int) (bptr - start) < *count; ++bptr)
+  for (len = 0; (unsigned int) (bptr - start) < *count; ++bptr)
     {
       if (INUSE(*bptr))
 	continue;
@@ -169,7 +342,10 @@ int fillchain(hfsvol *vol, bucket **bptr, unsigned int *count)
       if (len > 0 && (*bptr)->bnum != bnum)
 	break;
 
-      blist[len++] = *bptr;
+      if (len == 0)
+	first = bptr;
+
+      bufs[len++] = (*bptr)->data;
       bnum = (*bptr)->bnum + 1;
     }
 
@@ -179,25 +355,22 @@ int fillchain(hfsvol *vol, bucket **bptr, unsigned int *count)
     goto done;
   else if (len == 1)
     {
-      if (b_readpb(vol, vol->vstart + blist[0]->bnum,
-		   blist[0]->data, 1) == -1)
+      if (b_readpb(vol, vol->vstart + (*first)->bnum, bufs[0], 1) == -1)
 	goto fail;
     }
   else
     {
-      block buffer[HFS_BLOCKBUFSZ];
-
-      if (b_readpb(vol, vol->vstart + blist[0]->bnum, buffer, len) == -1)
+      if (readvec(vol, vol->vstart + (*first)->bnum, bufs, len) == -1)
 	goto fail;
-
-      for (i = 0; i < len; ++i)
-	memcpy(blist[i]->data, buffer[i], HFS_BLOCKSZ);
     }
 
-  for (i = 0; i < len; ++i)
+  for (; first < bptr; ++first)
     {
-      blist[i]->flags |=  HFS_BUCKET_INUSE;
-      blist[i]->flags &= ~HFS_BUCKET_DIRTY;
+      if (INUSE(*first))
+	continue;
+
+      mkclean(vol->cache, *first);
+      (*first)->flags |= HFS_BUCKET_INUSE;
     }
 
 done:
@@ -214,12 +387,12 @@ fail:
 static
 int flushchain(hfsvol *vol, bucket **bptr, unsigned int *count)
 {
-  bucket *blist[HFS_BLOCKBUFSZ], **start = bptr;
+  const block **bufs = (const block **) vol->cache->bufs;
+  bucket **start = bptr, **first = 0;
   unsigned long bnum;
-  unsigned int len, i;
+  unsigned int len;
 
-  for (len = 0; len < HFS_BLOCKBUFSZ &&
-	 (unsigned int) (bptr - start) < *count; ++bptr)
+  for (len = 0; (unsigned int) (bptr - start) < *count; ++bptr)
     {
       if (! INUSE(*bptr) || ! DIRTY(*bptr))
 	continue;
@@ -227,7 +400,10 @@ int flushchain(hfsvol *vol, bucket **bptr, unsigned int *count)
       if (len > 0 && (*bptr)->bnum != bnum)
 	break;
 
-      blist[len++] = *bptr;
+      if (len == 0)
+	first = bptr;
+
+      bufs[len++] = (*bptr)->data;
       bnum = (*bptr)->bnum + 1;
     }
 
@@ -237,23 +413,20 @@ int flushchain(hfsvol *vol, bucket **bptr, unsigned int *count)
     goto done;
   else if (len == 1)
     {
-      if (b_writepb(vol, vol->vstart + blist[0]->bnum,
-		    blist[0]->data, 1) == -1)
+      if (b_writepb(vol, vol->vstart + (*first)->bnum, bufs[0], 1) == -1)
 	goto fail;
     }
   else
     {
-      block buffer[HFS_BLOCKBUFSZ];
-
-      for (i = 0; i < len; ++i)
-	memcpy(buffer[i], blist[i]->data, HFS_BLOCKSZ);
-
-      if (b_writepb(vol, vol->vstart + blist[0]->bnum, buffer, len) == -1)
+      if (writevec(vol, vol->vstart + (*first)->bnum, bufs, len) == -1)
 	goto fail;
     }
 
-  for (i = 0; i < len; ++i)
-    blist[i]->flags &= ~HFS_BUCKET_DIRTY;
+  for (; first < bptr; ++first)
+    {
+      if (INUSE(*first))
+	mkclean(vol->cache, *first);
+    }
 
 done:
   return 0;
@@ -315,16 +488,18 @@ int dobuckets(hfsvol *vol, bucket **chain, unsigned int len,
 int b_flush(hfsvol *vol)
 {
   bcache *cache = vol->cache;
-  bucket *chain[HFS_CACHESZ];
-  int i;
+  bucket *b;
+  unsigned int len;
 
   if (cache == 0 || (vol->flags & HFS_VOL_READONLY))
     goto done;
 
-  for (i = 0; i < HFS_CACHESZ; ++i)
-    chain[i] = &cache->chain[i];
+  /* only the dirty buckets need sorting into runs */
 
-  if (flushbuckets(vol, chain, HFS_CACHESZ) == -1)
+  for (len = 0, b = cache->dirty; b; b = b->dnext)
+    cache->list[len++] = b;
+
+  if (flushbuckets(vol, cache->list, len) == -1)
     goto fail;
 
 done:
@@ -356,6 +531,14 @@ int b_finish(hfsvol *vol)
 
   result = b_flush(vol);
 
+  FREE(vol->cache->chain);
+  FREE(vol->cache->hash);
+  FREE(vol->cache->list);
+  FREE(vol->cache->ahead);
+  FREE(vol->cache->bufs);
+  FREE(vol->cache->spare);
+  FREE(vol->cache->pool);
+
   FREE(vol->cache);
   vol->cache = 0;
 
@@ -365,18 +548,18 @@ done:
 
 /*
  * NAME:	findbucket()
- * DESCRIPTION:	locate a bucket in the cache, and/or its hash slot
+ * DESCRIPTION:	locate a bucket (resident or ghost) in the cache, and its hash slot
  */
 static
 bucket *findbucket(bcache *cache, unsigned long bnum, bucket ***hslot)
 {
   bucket *b;
 
-  *hslot = &cache->hash[bnum & (HFS_HASHSZ - 1)];
+  *hslot = &cache->hash[bnum & (cache->hashsz - 1)];
 
   for (b = **hslot; b; b = b->hnext)
     {
-      if (INUSE(b) && b->bnum == bnum)
+      if (b->bnum == bnum)
 	break;
     }
 
@@ -384,39 +567,177 @@ bucket *findbucket(bcache *cache, unsigned long bnum, bucket ***hslot)
 }
 
 /*
- * NAME:	reuse()
- * DESCRIPTION:	free a bucket for reuse, flushing if necessary
+ * NAME:	hplace()
+ * DESCRIPTION:	move a bucket to the head of its hash slot
+ */
+static
+void hplace(bucket **hslot, bucket *b)
+{
+  if (*hslot != b)
+    {
+      if (b->hprev)
+	*b->hprev = b->hnext;
+      if (b->hnext)
+	b->hnext->hprev = b->hprev;
+
+      b->hprev = hslot;
+      b->hnext = *hslot;
+
+      if (*hslot)
+	(*hslot)->hprev = &b->hnext;
+
+      *hslot = b;
+    }
+}
+
+/*
+ * NAME:	hremove()
+ * DESCRIPTION:	remove a bucket from its hash slot
  */
 static
-int reuse(bcache *cache, bucket *b, unsigned long bnum)
+void hremove(bucket *b)
 {
-  bucket *chain[HFS_BLOCKBUFSZ], *bptr;
-  int i;
+  if (b->hprev)
+    *b->hprev = b->hnext;
+  if (b->hnext)
+    b->hnext->hprev = b->hprev;
+
+  b->hnext = 0;
+  b->hprev = 0;
+}
+
+/*
+ * NAME:	lremove()
+ * DESCRIPTION:	unlink a bucket from its replacement list
+ */
+static
+void lremove(bcache *cache, bucket *b)
+{
+  if (b->cnext == b)
+    cache->head[b->list] = 0;
+  else
+    {
+      b->cnext->cprev = b->cprev;
+      b->cprev->cnext = b->cnext;
+
+      if (cache->head[b->list] == b)
+	cache->head[b->list] = b->cnext;
+    }
+
+  --cache->len[b->list];
+}
+
+/*
+ * NAME:	linsert()
+ * DESCRIPTION:	link a bucket at the most recently used end of a list
+ */
+static
+void linsert(bcache *cache, int list, bucket *b)
+{
+  bucket *head = cache->head[list];
+
+  if (head == 0)
+    {
+      b->cnext = b;
+      b->cprev = b;
+    }
+  else
+    {
+      b->cnext = head;
+      b->cprev = head->cprev;
+
+      head->cprev->cnext = b;
+      head->cprev = b;
+    }
+
+  b->list = list;
+
+  cache->head[list] = b;
+  ++cache->len[list];
+}
+
+/*
+ * NAME:	lmove()
+ * DESCRIPTION:	move a bucket to the most recently used end of a list
+ */
+static
+void lmove(bcache *cache, int list, bucket *b)
+{
+  if (cache->head[list] != b)
+    {
+      lremove(cache, b);
+      linsert(cache, list, b);
+    }
+}
+
+/*
+ * NAME:	victim()
+ * DESCRIPTION:	return the least recently used evictable bucket of a list
+ */
+static
+bucket *victim(bcache *cache, int list)
+{
+  bucket *b;
+  unsigned int i;
+
+  /* skip buckets still waiting to be filled */
+
+  for (i = 0, b = cache->head[list]; i < cache->len[list]; ++i)
+    {
+      b = b->cprev;
+
+      if (INUSE(b))
+	return b;
+    }
+
+  return 0;
+}
+
+/*
+ * NAME:	evict()
+ * DESCRIPTION:	release a resident bucket's block, flushing if necessary
+ */
+static
+int evict(bcache *cache, bucket *b)
+{
+  bucket *chain[HFS_BLOCKBUFSZ], **hslot, *bptr;
+  unsigned long bnum;
+  unsigned int len;
 
 # ifdef DEBUG
-  if (INUSE(b))
-    fprintf(stderr, "BLOCK: CACHE reusing bucket containing "
-	    "vol 0x%lx block %lu:%u\n",
-	    (unsigned long) cache->vol, b->bnum, b->count);
+  fprintf(stderr, "BLOCK: CACHE evicting vol 0x%lx block %lu\n",
+	  (unsigned long) cache->vol, b->bnum);
 # endif
 
-  if (INUSE(b) && DIRTY(b))
+  if (DIRTY(b))
     {
-      /* flush most recently unused buckets */
+      /* flush along with any physically adjacent dirty buckets */
 
-      for (bptr = b, i = 0; i < HFS_BLOCKBUFSZ; ++i)
+      for (bnum = b->bnum, len = 0;
+	   bnum > 0 && len < (HFS_BLOCKBUFSZ >> 1); --bnum, ++len)
 	{
-	  chain[i] = bptr;
-	  bptr = bptr->cprev;
+	  bptr = findbucket(cache, bnum - 1, &hslot);
+	  if (bptr == 0 || ! INUSE(bptr) || ! DIRTY(bptr))
+	    break;
 	}
 
-      if (flushbuckets(cache->vol, chain, HFS_BLOCKBUFSZ) == -1)
+      for (len = 0; len < HFS_BLOCKBUFSZ; ++bnum, ++len)
+	{
+	  bptr = findbucket(cache, bnum, &hslot);
+	  if (bptr == 0 || ! INUSE(bptr) || ! DIRTY(bptr))
+	    break;
+
+	  chain[len] = bptr;
+	}
+
+      if (flushchain(cache->vol, chain, &len) == -1)
 	goto fail;
     }
 
-  b->flags &= ~HFS_BUCKET_INUSE;
-  b->count  = 1;
-  b->bnum   = bnum;
+  cache->spare[cache->nspare++] = b->data;
+
+  b->flags = 0;
+  b->data  = 0;
 
   return 0;
 
@@ -425,52 +746,167 @@ fail:
 }
 
 /*
- * NAME:	cplace()
- * DESCRIPTION:	move a bucket to an appropriate place near head of the chain
+ * NAME:	discard()
+ * DESCRIPTION:	return a bucket header (and any block) to the unused pool
  */
 static
-void cplace(bcache *cache, bucket *b)
+void discard(bcache *cache, bucket *b)
 {
-  bucket *p;
+  if (b->data)
+    cache->spare[cache->nspare++] = b->data;
+
+  mkclean(cache, b);
+  lremove(cache, b);
+  hremove(b);
 
-  for (p = cache->tail->cnext; p->count > 1; p = p->cnext)
-    --p->count;
+  b->flags = 0;
+  b->list  = HFS_ARC_FREE;
+  b->data  = 0;
 
-  b->cnext->cprev = b->cprev;
-  b->cprev->cnext = b->cnext;
+  b->cnext = cache->free;
+  b->cprev = 0;
 
-  if (cache->tail == b)
-    cache->tail = b->cprev;
+  cache->free = b;
+}
 
-  b->cprev = p->cprev;
-  b->cnext = p;
+/*
+ * NAME:	replace()
+ * DESCRIPTION:	demote a resident bucket to a ghost to free a block (ARC)
+ */
+static
+int replace(bcache *cache, int inb2)
+{
+  bucket *b;
+  int from;
 
-  p->cprev->cnext = b;
-  p->cprev = b;
+  if (cache->len[HFS_ARC_T1] > 0 &&
+      (cache->len[HFS_ARC_T1] > cache->target ||
+       (inb2 && cache->len[HFS_ARC_T1] == cache->target)))
+    from = HFS_ARC_T1;
+  else
+    from = HFS_ARC_T2;
+
+  b = victim(cache, from);
+  if (b == 0)
+    {
+      from = (from == HFS_ARC_T1) ? HFS_ARC_T2 : HFS_ARC_T1;
+      b = victim(cache, from);
+    }
+
+  if (b == 0)
+    ERROR(EIO, "no evictable cache block");
+
+  if (evict(cache, b) == -1)
+    goto fail;
+
+  lremove(cache, b);
+  linsert(cache, from == HFS_ARC_T1 ? HFS_ARC_B1 : HFS_ARC_B2, b);
+
+  return 0;
+
+fail:
+  return -1;
 }
 
 /*
- * NAME:	hplace()
- * DESCRIPTION:	move a bucket to the head of its hash slot
+ * NAME:	admit()
+ * DESCRIPTION:	make a missed block resident, adapting the ARC target
  */
 static
-void hplace(bucket **hslot, bucket *b)
+bucket *admit(bcache *cache, bucket *ghost, unsigned long bnum,
+	      bucket **hslot)
 {
-  if (*hslot != b)
+  unsigned int *len = cache->len, c = cache->size, delta;
+  bucket *b;
+  int list;
+
+  if (ghost)
     {
-      if (b->hprev)
-	*b->hprev = b->hnext;
-      if (b->hnext)
-	b->hnext->hprev = b->hprev;
+      /* ghost hit: favor whichever list would have kept the block */
 
-      b->hprev = hslot;
-      b->hnext = *hslot;
+      if (ghost->list == HFS_ARC_B1)
+	{
+	  delta = len[HFS_ARC_B2] / len[HFS_ARC_B1];
+	  if (delta < 1)
+	    delta = 1;
 
-      if (*hslot)
-	(*hslot)->hprev = &b->hnext;
+	  cache->target = (cache->target + delta > c) ?
+	    c : cache->target + delta;
+	}
+      else
+	{
+	  delta = len[HFS_ARC_B1] / len[HFS_ARC_B2];
+	  if (delta < 1)
+	    delta = 1;
 
-      *hslot = b;
+	  cache->target = (cache->target > delta) ?
+	    cache->target - delta : 0;
+	}
+
+      if (cache->nspare == 0 &&
+	  replace(cache, ghost->list == HFS_ARC_B2) == -1)
+	goto fail;
+
+      b = ghost;
+      lremove(cache, b);
+
+      list = HFS_ARC_T2;
     }
+  else
+    {
+      /* complete miss: keep T1+B1 and the whole directory within bounds */
+
+      if (len[HFS_ARC_T1] + len[HFS_ARC_B1] >= c)
+	{
+	  if (len[HFS_ARC_T1] < c)
+	    {
+	      discard(cache, cache->head[HFS_ARC_B1]->cprev);
+
+	      if (cache->nspare == 0 &&
+		  replace(cache, 0) == -1)
+		goto fail;
+	    }
+	  else
+	    {
+	      b = victim(cache, HFS_ARC_T1);
+	      if (b == 0)
+		ERROR(EIO, "no evictable cache block");
+
+	      if (evict(cache, b) == -1)
+		goto fail;
+
+	      discard(cache, b);
+	    }
+	}
+      else if (len[HFS_ARC_T1] + len[HFS_ARC_T2] +
+	       len[HFS_ARC_B1] + len[HFS_ARC_B2] >= c)
+	{
+	  if (len[HFS_ARC_T1] + len[HFS_ARC_T2] +
+	      len[HFS_ARC_B1] + len[HFS_ARC_B2] >= (c << 1))
+	    discard(cache, cache->head[HFS_ARC_B2]->cprev);
+
+	  if (cache->nspare == 0 &&
+	      replace(cache, 0) == -1)
+	    goto fail;
+	}
+
+      b = cache->free;
+      cache->free = b->cnext;
+
+      list = HFS_ARC_T1;
+    }
+
+  b->flags = 0;
+  b->bnum  = bnum;
+  b->data  = cache->spare[--cache->nspare];
+
+  linsert(cache, list, b);
+  hplace(hslot, b);
+
+  return b;
+
+fail:
+  return 0;
 }
 
 /*
@@ -480,87 +916,91 @@ void hplace(bucket **hslot, bucket *b)
 static
 bucket *getbucket(bcache *cache, unsigned long bnum, int fill)
 {
-  bucket **hslot, *b, *p, *bptr,
-    *chain[HFS_BLOCKBUFSZ], **slots[HFS_BLOCKBUFSZ];
+  bucket **hslot, *b, *bptr, **chain = cache->ahead;
+  unsigned long next;
+  unsigned int len;
 
   b = findbucket(cache, bnum, &hslot);
 
-  if (b)
+  if (b && b->data)
     {
-      /* cache hit; move towards head of cache chain */
+      /* cache hit; a block read ahead, or requested again immediately
+	 (e.g. in pieces), has not yet earned a place on the T2 list */
 
       ++cache->hits;
 
-      if (++b->count > b->cprev->count &&
-	  b != cache->tail->cnext)
+      if (b->flags & HFS_BUCKET_AHEAD)
 	{
-	  p = b->cprev;
-
-	  p->cprev->cnext = b;
-	  b->cnext->cprev = p;
-
-	  p->cnext = b->cnext;
-	  b->cprev = p->cprev;
+	  b->flags &= ~HFS_BUCKET_AHEAD;
+	  lmove(cache, HFS_ARC_T1, b);
+	}
+      else if (b->list == HFS_ARC_T1 && bnum == cache->last)
+	lmove(cache, HFS_ARC_T1, b);
+      else
+	lmove(cache, HFS_ARC_T2, b);
 
-	  p->cprev = b;
-	  b->cnext = p;
+      hplace(hslot, b);
 
-	  if (cache->tail == b)
-	    cache->tail = p;
+      if (fill && ! INUSE(b) &&
+	  fillbuckets(cache->vol, &b, 1) == -1)
+	{
+	  discard(cache, b);
+	  goto fail;
 	}
     }
   else
     {
-      /* cache miss; reuse least-used cache bucket */
+      /* cache miss (or ghost hit); make resident and read ahead */
 
       ++cache->misses;
 
-      b = cache->tail;
-
-      if (reuse(cache, b, bnum) == -1)
+      b = admit(cache, b, bnum, hslot);
+      if (b == 0)
 	goto fail;
 
       if (fill)
 	{
-	  unsigned int len = 0;
+	  /* grow the read-ahead window while the stream is sequential */
 
-	  chain[len]   = b;
-	  slots[len++] = hslot;
+	  if (bnum == cache->ranext && bnum != 0)
+	    {
+	      cache->rawin <<= 1;
+	      if (cache->rawin > cache->ramax)
+		cache->rawin = cache->ramax;
+	    }
+	  else
+	    cache->rawin = HFS_BLOCKBUFSZ >> 1;
 
-	  for (bptr = b->cprev;
-	       len < (HFS_BLOCKBUFSZ >> 1) && ++bnum < cache->vol->vlen;
-	       bptr = bptr->cprev)
+	  len = 0;
+	  chain[len++] = b;
+
+	  for (next = bnum + 1;
+	       len < cache->rawin && next < cache->vol->vlen; ++next)
 	    {
-	      if (findbucket(cache, bnum, &hslot))
+	      if (findbucket(cache, next, &hslot))
 		break;
 
-	      if (reuse(cache, bptr, bnum) == -1)
-		goto fail;
+	      bptr = admit(cache, 0, next, hslot);
+	      if (bptr == 0)
+		break;
 
-	      chain[len]   = bptr;
-	      slots[len++] = hslot;
+	      bptr->flags |= HFS_BUCKET_AHEAD;
+	      chain[len++] = bptr;
 	    }
 
-	  if (fillbuckets(cache->vol, chain, len) == -1)
-	    goto fail;
+	  cache->ranext = bnum + len;
 
-	  while (--len)
+	  if (fillbuckets(cache->vol, chain, len) == -1)
 	    {
-	      cplace(cache, chain[len]);
-	      hplace(slots[len], chain[len]);
-	    }
+	      while (len--)
+		discard(cache, chain[len]);
 
-	  hslot = slots[0];
+	      goto fail;
+	    }
 	}
-
-      /* move bucket to appropriate place in chain */
-
-      cplace(cache, b);
     }
 
-  /* insert at front of hash chain */
-
-  hplace(hslot, b);
+  cache->last = bnum;
 
   return b;
 
@@ -585,14 +1025,7 @@ int b_readpb(hfsvol *vol, unsigned long bnum, block *bp, unsigned int blen)
     fprintf(stderr, "\n");
 # endif
 
-  nblocks = os_seek(&vol->priv, bnum);
-  if (nblocks == (unsigned long) -1)
-    goto fail;
-
-  if (nblocks != bnum)
-    ERROR(EIO, "block seek failed for read");
-
-  nblocks = os_read(&vol->priv, bp, blen);
+  nblocks = os_read(&vol->priv, bp, blen, bnum);
   if (nblocks == (unsigned long) -1)
     goto fail;
 
@@ -623,14 +1056,7 @@ int b_writepb(hfsvol *vol, unsigned long bnum, const block *bp,
     fprintf(stderr, "\n");
 # endif
 
-  nblocks = os_seek(&vol->priv, bnum);
-  if (nblocks == (unsigned long) -1)
-    goto fail;
-
-  if (nblocks != bnum)
-    ERROR(EIO, "block seek failed for write");
-
-  nblocks = os_write(&vol->priv, bp, blen);
+  nblocks = os_write(&vol->priv, bp, blen, bnum);
   if (nblocks == (unsigned long) -1)
     goto fail;
 
@@ -695,7 +1121,12 @@ int b_writelb(hfsvol *vol, unsigned long bnum, const block *bp)
 	  memcmp(b->data, bp, HFS_BLOCKSZ) != 0)
 	{
 	  memcpy(b->data, bp, HFS_BLOCKSZ);
-	  b->flags |= HFS_BUCKET_INUSE | HFS_BUCKET_DIRTY;
+	  b->flags |= HFS_BUCKET_INUSE;
+
+	  mkdirty(vol->cache, b);
+
+	  if (vol->wb && vol->cache->ndirty >= vol->wb->mark)
+	    v_kickwb(vol);
 	}
     }
   else
@@ -710,6 +1141,55 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	block->prefetch()
+ * DESCRIPTION:	read a run of logical blocks into the cache ahead of use
+ */
+int b_prefetch(hfsvol *vol, unsigned long bnum, unsigned int count)
+{
+  bcache *cache = vol->cache;
+  bucket **hslot, *b, **chain;
+  unsigned int len = 0;
+
+  /* nothing to do if uncached, or if the run was already fetched */
+
+  if (cache == 0 ||
+      ((b = findbucket(cache, bnum, &hslot)) && b->data))
+    goto done;
+
+  chain = cache->ahead;
+
+  if (count > cache->ramax)
+    count = cache->ramax;
+
+  for (; len < count && bnum < vol->vlen; ++bnum)
+    {
+      if (findbucket(cache, bnum, &hslot))
+	continue;
+
+      b = admit(cache, 0, bnum, hslot);
+      if (b == 0)
+	break;
+
+      b->flags |= HFS_BUCKET_AHEAD;
+      chain[len++] = b;
+    }
+
+  if (fillbuckets(vol, chain, len) == -1)
+    {
+      while (len--)
+	discard(cache, chain[len]);
+
+      goto fail;
+    }
+
+done:
+  return 0;
+
+fail:
+  return -1;
+}
+
 /*
  * NAME:	block->readab()
  * DESCRIPTION:	read a block from an allocation block from a volume
@@ -752,6 +1232,122 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	checkrun()
+ * DESCRIPTION:	verify a run of blocks lies within allocated allocation blocks
+ */
+static
+int checkrun(hfsvol *vol, unsigned int anum, unsigned int index,
+	     unsigned long blen)
+{
+  unsigned long last, i;
+
+  last = anum + (index + blen - 1) / vol->lpa;
+
+  if (last >= vol->mdb.drNmAlBlks)
+    ERROR(EIO, "access to nonexistent allocation block");
+
+  if (vol->vbm)
+    {
+      for (i = anum; i <= last; ++i)
+	{
+	  if (! BMTST(vol->vbm, i))
+	    ERROR(EIO, "access to unallocated block");
+	}
+    }
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	block->readabs()
+ * DESCRIPTION:	read consecutive blocks spanning allocation blocks directly
+ */
+int b_readabs(hfsvol *vol, unsigned int anum, unsigned int index,
+	      block *bp, unsigned long blen)
+{
+  bcache *cache = vol->cache;
+  unsigned long bnum, i;
+
+  if (checkrun(vol, anum, index, blen) == -1)
+    goto fail;
+
+  bnum = vol->mdb.drAlBlSt + anum * vol->lpa + index;
+
+  if (vol->vlen > 0 && bnum + blen > vol->vlen)
+    ERROR(EIO, "read nonexistent logical block");
+
+  if (b_readpb(vol, vol->vstart + bnum, bp, blen) == -1)
+    goto fail;
+
+  /* cached blocks not yet written back supersede the medium */
+
+  if (cache && cache->ndirty > 0)
+    {
+      for (i = 0; i < blen; ++i)
+	{
+	  bucket **hslot, *b;
+
+	  b = findbucket(cache, bnum + i, &hslot);
+	  if (b && INUSE(b) && DIRTY(b))
+	    memcpy(&bp[i], b->data, HFS_BLOCKSZ);
+	}
+    }
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	block->writeabs()
+ * DESCRIPTION:	write consecutive blocks spanning allocation blocks directly
+ */
+int b_writeabs(hfsvol *vol, unsigned int anum, unsigned int index,
+	       const block *bp, unsigned long blen)
+{
+  bcache *cache = vol->cache;
+  unsigned long bnum, i;
+
+  if (checkrun(vol, anum, index, blen) == -1)
+    goto fail;
+
+  bnum = vol->mdb.drAlBlSt + anum * vol->lpa + index;
+
+  if (vol->vlen > 0 && bnum + blen > vol->vlen)
+    ERROR(EIO, "write nonexistent logical block");
+
+  if (v_dirty(vol) == -1 ||
+      b_writepb(vol, vol->vstart + bnum, bp, blen) == -1)
+    goto fail;
+
+  /* keep cached copies identical to the medium */
+
+  if (cache)
+    {
+      for (i = 0; i < blen; ++i)
+	{
+	  bucket **hslot, *b;
+
+	  b = findbucket(cache, bnum + i, &hslot);
+	  if (b && INUSE(b))
+	    {
+	      memcpy(b->data, &bp[i], HFS_BLOCKSZ);
+	      mkclean(cache, b);
+	    }
+	}
+    }
+
+  return 0;
+
+fail:
+  return -1;
+}
+
 /*
  * NAME:	block->size()
  * DESCRIPTION:	return the number of physical blocks on a volume's medium
@@ -31,9 +31,15 @@ int b_writepb(hfsvol *, unsigned long, const block *, unsigned int);
 int b_readlb(hfsvol *, unsigned long, block *);
 int b_writelb(hfsvol *, unsigned long, const block *);
 
+int b_prefetch(hfsvol *, unsigned long, unsigned int);
+
 int b_readab(hfsvol *, unsigned int, unsigned int, block *);
 int b_writeab(hfsvol *, unsigned int, unsigned int, const block *);
 
+int b_readabs(hfsvol *, unsigned int, unsigned int, block *, unsigned long);
+int b_writeabs(hfsvol *, unsigned int, unsigned int,
+	       const block *, unsigned long);
+
 unsigned long b_size(hfsvol *);
 
 # ifdef DEBUG
@@ -30,6 +30,28 @@
 # include "block.h"
 # include "node.h"
 
+/*
+ * NAME:	cachednode()
+ * DESCRIPTION:	return the node cache slot for a node number, or 0
+ */
+static
+node *cachednode(btree *bt, unsigned long nnum)
+{
+  if (bt->ncache == 0)
+    {
+      unsigned int i;
+
+      bt->ncache = ALLOC(node, HFS_NCACHESZ);
+      if (bt->ncache == 0)
+	return 0;  /* carry on without caching */
+
+      for (i = 0; i < HFS_NCACHESZ; ++i)
+	bt->ncache[i].bt = 0;
+    }
+
+  return &bt->ncache[nnum & (HFS_NCACHESZ - 1)];
+}
+
 /*
  * NAME:	btree->getnode()
  * DESCRIPTION:	retrieve a numbered node from a B*-tree file
@@ -37,6 +59,7 @@
 int bt_getnode(node *np, btree *bt, unsigned long nnum)
 {
   block *bp = &np->data;
+  node *cp;
   const byte *ptr;
   int i;
 
@@ -55,7 +78,16 @@ int bt_getnode(node *np, btree *bt, unsigned long nnum)
   else if (bt->map && ! BMTST(bt->map, nnum))
     ERROR(EIO, "read unallocated b*-tree node");
 
-  if (f_getblock(&bt->f, nnum, bp) == -1)
+  cp = cachednode(bt, nnum);
+  if (cp && cp->bt == bt && cp->nnum == nnum)
+    {
+      *np = *cp;
+      return 0;
+    }
+
+  if (bt->nodes)
+    memcpy(bp, &bt->nodes[nnum], HFS_BLOCKSZ);
+  else if (f_getblock(&bt->f, nnum, bp) == -1)
     goto fail;
 
   ptr = *bp;
@@ -77,6 +109,9 @@ int bt_getnode(node *np, btree *bt, unsigned long nnum)
   while (i--)
     d_fetchuw(&ptr, &np->roff[i]);
 
+  if (cp)
+    *cp = *np;
+
   return 0;
 
 fail:
@@ -91,6 +126,7 @@ int bt_putnode(node *np)
 {
   btree *bt = np->bt;
   block *bp = &np->data;
+  node *cp;
   byte *ptr;
   int i;
 
@@ -125,12 +161,70 @@ int bt_putnode(node *np)
   while (i--)
     d_storeuw(&ptr, np->roff[i]);
 
-  return f_putblock(&bt->f, np->nnum, bp);
+  /* keep the node cache coherent with what was (or wasn't) written */
+
+  cp = cachednode(bt, np->nnum);
+
+  ++bt->gen;
+
+  if (f_putblock(&bt->f, np->nnum, bp) == -1)
+    {
+      if (cp && cp->bt == bt && cp->nnum == np->nnum)
+	cp->bt = 0;
+
+      goto fail;
+    }
+
+  if (cp)
+    *cp = *np;
+
+  return 0;
 
 fail:
   return -1;
 }
 
+/*
+ * NAME:	btree->prefetch()
+ * DESCRIPTION:	start reading the nodes following a sibling link
+ */
+void bt_prefetch(btree *bt, unsigned long nnum)
+{
+  hfsvol *vol = bt->f.vol;
+  unsigned long count, run;
+  unsigned int anum, len, index;
+
+  /* leaf nodes are mostly allocated in link order, so read the next
+     several node numbers, one physical run per extent of the tree file */
+
+  if (vol->cache == 0 || bt->nodes ||
+      nnum == 0 || nnum >= bt->hdr.bthNNodes)
+    return;
+
+  count = bt->hdr.bthNNodes - nnum;
+  if (count > HFS_BTPREFETCH)
+    count = HFS_BTPREFETCH;
+
+  while (count)
+    {
+      if (f_locate(&bt->f, nnum / vol->lpa, &anum, &len) == -1)
+	break;
+
+      index = nnum % vol->lpa;
+
+      run = (unsigned long) len * vol->lpa - index;
+      if (run > count)
+	run = count;
+
+      if (b_prefetch(vol, vol->mdb.drAlBlSt + anum * vol->lpa + index,
+		     run) == -1)
+	break;
+
+      nnum  += run;
+      count -= run;
+    }
+}
+
 /*
  * NAME:	btree->readhdr()
  * DESCRIPTION:	read the header node of a B*-tree
@@ -222,6 +316,47 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	btree->load()
+ * DESCRIPTION:	read an entire (read-only) b*-tree file into memory
+ */
+int bt_load(btree *bt)
+{
+  hfsvol *vol = bt->f.vol;
+  unsigned long nnum, count;
+  unsigned int anum, len, index;
+  block *nodes;
+
+  nodes = ALLOC(block, bt->hdr.bthNNodes);
+  if (nodes == 0)
+    ERROR(ENOMEM, "can't hold b*-tree in memory");
+
+  /* one large read per extent of the tree file */
+
+  for (nnum = 0; nnum < bt->hdr.bthNNodes; nnum += count)
+    {
+      if (f_locate(&bt->f, nnum / vol->lpa, &anum, &len) == -1)
+	goto fail;
+
+      index = nnum % vol->lpa;
+
+      count = (unsigned long) len * vol->lpa - index;
+      if (count > bt->hdr.bthNNodes - nnum)
+	count = bt->hdr.bthNNodes - nnum;
+
+      if (b_readabs(vol, anum, index, &nodes[nnum], count) == -1)
+	goto fail;
+    }
+
+  bt->nodes = nodes;
+
+  return 0;
+
+fail:
+  FREE(nodes);
+  return -1;
+}
+
 /*
  * NAME:	btree->writehdr()
  * DESCRIPTION:	write the header node of a B*-tree
@@ -23,8 +23,10 @@
 
 int bt_getnode(node *, btree *, unsigned long);
 int bt_putnode(node *);
+void bt_prefetch(btree *, unsigned long);
 
 int bt_readhdr(btree *);
+int bt_load(btree *);
 int bt_writehdr(btree *);
 
 int bt_space(btree *, unsigned int);
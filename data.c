@@ -21,6 +21,7 @@
 
 # include <string.h>
 # include <time.h>
+# include <pthread.h>
 
 # ifdef TM_IN_SYS_TIME
 #  include <sys/time.h>
@@ -31,7 +32,10 @@
 # define TIMEDIFF  2082844800UL
 
 static
-time_t tzdiff = -1;
+time_t tzdiff;
+
+static
+pthread_once_t tzonce = PTHREAD_ONCE_INIT;
 
 const
 unsigned char hfs_charorder[256] = {
@@ -429,18 +433,13 @@ static
 void calctzdiff(void)
 {
   time_t t;
-  int isdst;
-  struct tm tm;
-  const struct tm *tmp;
+  struct tm lt, tm;
 
   time(&t);
-  isdst = localtime(&t)->tm_isdst;
 
-  tmp = gmtime(&t);
-  if (tmp)
+  if (localtime_r(&t, &lt) && gmtime_r(&t, &tm))
     {
-      tm = *tmp;
-      tm.tm_isdst = isdst;
+      tm.tm_isdst = lt.tm_isdst;
 
       tzdiff = t - mktime(&tm);
     }
@@ -454,8 +453,7 @@ void calctzdiff(void)
  */
 time_t d_ltime(unsigned long mtime)
 {
-  if (tzdiff == -1)
-    calctzdiff();
+  pthread_once(&tzonce, calctzdiff);
 
   return (time_t) (mtime - TIMEDIFF) - tzdiff;
 }
@@ -466,8 +464,7 @@ time_t d_ltime(unsigned long mtime)
  */
 unsigned long d_mtime(time_t ltime)
 {
-  if (tzdiff == -1)
-    calctzdiff();
+  pthread_once(&tzonce, calctzdiff);
 
   return (unsigned long) (ltime + tzdiff) + TIMEDIFF;
 }
@@ -19,6 +19,7 @@
  * $Id: file.c,v 1.9 1998/11/02 22:08:59 rob Exp $
  */
 
+# include <stdlib.h>
 # include <string.h>
 # include <errno.h>
 
@@ -84,6 +85,9 @@ void f_init(hfsfile *file, hfsvol *vol, long cnid, const char *name)
 
   file->cat.u.fil.filResrv   = 0;
 
+  file->map   = 0;
+  file->mapsz = 0;
+
   f_selectfork(file, fkData);
 
   file->flags = 0;
@@ -98,6 +102,8 @@ void f_init(hfsfile *file, hfsvol *vol, long cnid, const char *name)
  */
 void f_selectfork(hfsfile *file, int fork)
 {
+  f_freemap(file);
+
   file->fork = fork;
 
   memcpy(&file->ext, fork == fkData ?
@@ -136,57 +142,168 @@ void f_getptrs(hfsfile *file, ExtDataRec **extrec,
 }
 
 /*
- * NAME:	file->doblock()
- * DESCRIPTION:	read or write a numbered block from a file
+ * NAME:	file->freemap()
+ * DESCRIPTION:	discard a file's extent map
  */
-int f_doblock(hfsfile *file, unsigned long num, block *bp,
-	      int (*func)(hfsvol *, unsigned int, unsigned int, block *))
+void f_freemap(hfsfile *file)
+{
+  FREE(file->map);
+
+  file->map   = 0;
+  file->mapsz = 0;
+}
+
+/*
+ * NAME:	addmap()
+ * DESCRIPTION:	append an extent to a file's extent map
+ */
+static
+int addmap(hfsfile *file, unsigned int fabn, unsigned int abn,
+	   unsigned int len)
 {
-  unsigned int abnum;
-  unsigned int blnum;
-  unsigned int fabn;
+  extent *map, *last;
+
+  if (file->mapsz > 0)
+    {
+      last = &file->map[file->mapsz - 1];
+
+      if (last->abn + last->len == abn)
+	{
+	  last->len += len;
+	  goto done;
+	}
+    }
+
+  map = REALLOC(file->map, extent, file->mapsz + 1);
+  if (map == 0)
+    ERROR(ENOMEM, 0);
+
+  file->map = map;
+
+  map[file->mapsz].fabn = fabn;
+  map[file->mapsz].abn  = abn;
+  map[file->mapsz].len  = len;
+
+  ++file->mapsz;
+
+done:
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	buildmap()
+ * DESCRIPTION:	gather all extents of the current fork into a sorted map
+ */
+static
+int buildmap(hfsfile *file)
+{
+  ExtDataRec *extrec, rec;
+  unsigned long *pylen;
+  unsigned int fabn, end;
   int i;
 
-  abnum = num / file->vol->lpa;
-  blnum = num % file->vol->lpa;
+  f_getptrs(file, &extrec, 0, &pylen);
+
+  end = *pylen / file->vol->mdb.drAlBlkSiz;
 
-  /* locate the appropriate extent record */
+  file->map = ALLOC(extent, 1);
+  if (file->map == 0)
+    ERROR(ENOMEM, 0);
 
-  fabn = file->fabn;
+  file->mapsz = 0;
 
-  if (abnum < fabn)
+  memcpy(&rec, extrec, sizeof(ExtDataRec));
+
+  for (fabn = 0; fabn < end; )
     {
-      ExtDataRec *extrec;
+      for (i = 0; i < 3 && fabn < end; ++i)
+	{
+	  unsigned int n;
 
-      f_getptrs(file, &extrec, 0, 0);
+	  n = rec[i].xdrNumABlks;
+	  if (n == 0)
+	    ERROR(EIO, "empty file extent");
 
-      fabn = file->fabn = 0;
-      memcpy(&file->ext, extrec, sizeof(ExtDataRec));
+	  if (addmap(file, fabn, rec[i].xdrStABN, n) == -1)
+	    goto fail;
+
+	  fabn += n;
+	}
+
+      if (fabn < end &&
+	  v_extsearch(file, fabn, &rec, 0) <= 0)
+	ERROR(EIO, "missing file extent record");
     }
-  else
-    abnum -= fabn;
 
-  while (1)
-    {
-      unsigned int n;
+  return 0;
 
-      for (i = 0; i < 3; ++i)
-	{
-	  n = file->ext[i].xdrNumABlks;
+fail:
+  f_freemap(file);
+  return -1;
+}
 
-	  if (abnum < n)
-	    return func(file->vol, file->ext[i].xdrStABN + abnum, blnum, bp);
+/*
+ * NAME:	file->locate()
+ * DESCRIPTION:	map a fork allocation block to a volume allocation block
+ */
+int f_locate(hfsfile *file, unsigned int abnum,
+	     unsigned int *anum, unsigned int *len)
+{
+  const extent *ext;
+  unsigned int lo, hi, mid;
 
-	  fabn  += n;
-	  abnum -= n;
-	}
+  if (file->map == 0 &&
+      buildmap(file) == -1)
+    goto fail;
 
-      if (v_extsearch(file, fabn, &file->ext, 0) <= 0)
-	goto fail;
+  /* binary search for the last extent starting at or before abnum */
+
+  lo = 0;
+  hi = file->mapsz;
 
-      file->fabn = fabn;
+  while (hi - lo > 1)
+    {
+      mid = (lo + hi) >> 1;
+
+      if (file->map[mid].fabn <= abnum)
+	lo = mid;
+      else
+	hi = mid;
     }
 
+  ext = &file->map[lo];
+
+  if (file->mapsz == 0 ||
+      abnum < ext->fabn || abnum - ext->fabn >= ext->len)
+    ERROR(EIO, "file block beyond physical length");
+
+  *anum = ext->abn + (abnum - ext->fabn);
+  if (len)
+    *len = ext->len - (abnum - ext->fabn);
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	file->doblock()
+ * DESCRIPTION:	read or write a numbered block from a file
+ */
+int f_doblock(hfsfile *file, unsigned long num, block *bp,
+	      int (*func)(hfsvol *, unsigned int, unsigned int, block *))
+{
+  unsigned int anum;
+
+  if (f_locate(file, num / file->vol->lpa, &anum, 0) == -1)
+    goto fail;
+
+  return func(file->vol, anum, num % file->vol->lpa, bp);
+
 fail:
   return -1;
 }
@@ -294,6 +411,12 @@ int f_addextent(hfsfile *file, ExtDescriptor *blocks)
 
   file->flags |= HFS_FILE_UPDATE_CATREC;
 
+  /* keep any extent map current (or discard it) */
+
+  if (file->map &&
+      addmap(file, end, blocks->xdrStABN, blocks->xdrNumABlks) == -1)
+    f_freemap(file);
+
   return 0;
 
 fail:
@@ -420,6 +543,8 @@ int f_trunc(hfsfile *file)
 
   file->flags |= HFS_FILE_UPDATE_CATREC;
 
+  f_freemap(file);
+
   do
     {
       while (dlen && ++i < 3)
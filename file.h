@@ -30,6 +30,8 @@ void f_init(hfsfile *, hfsvol *, long, const char *);
 void f_selectfork(hfsfile *, int);
 void f_getptrs(hfsfile *, ExtDataRec **, unsigned long **, unsigned long **);
 
+void f_freemap(hfsfile *);
+int f_locate(hfsfile *, unsigned int, unsigned int *, unsigned int *);
 int f_doblock(hfsfile *, unsigned long, block *,
 	      int (*)(hfsvol *, unsigned int, unsigned int, block *));
 
@@ -34,10 +34,16 @@
 # include "record.h"
 # include "volume.h"
 
-const char *hfs_error = "no error";	/* static error string */
+HFS_THREAD
+const char *hfs_error = "no error";	/* per-thread error string */
 
 hfsvol *hfs_mounts;			/* linked list of mounted volumes */
 
+pthread_mutex_t hfs_mountlock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+pthread_mutex_t medialock = PTHREAD_MUTEX_INITIALIZER;	/* mount/umount I/O */
+
 static
 hfsvol *curvol;				/* current volume */
 
@@ -75,10 +81,12 @@ int getvol(hfsvol **vol)
 {
   if (*vol == 0)
     {
-      if (curvol == 0)
-	ERROR(EINVAL, "no volume is current");
-
+      pthread_mutex_lock(&hfs_mountlock);
       *vol = curvol;
+      pthread_mutex_unlock(&hfs_mountlock);
+
+      if (*vol == 0)
+	ERROR(EINVAL, "no volume is current");
     }
 
   return 0;
@@ -87,6 +95,27 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	lockvol()
+ * DESCRIPTION:	validate and lock the volume a call (and pathname) refers to
+ */
+static
+int lockvol(hfsvol **vol, const char *path)
+{
+  if (getvol(vol) == -1)
+    goto fail;
+
+  if (path)
+    *vol = v_pathvol(*vol, path);
+
+  v_lock(*vol);
+
+  return 0;
+
+fail:
+  return -1;
+}
+
 /* High-Level Volume Routines ============================================== */
 
 /*
@@ -95,33 +124,73 @@ fail:
  */
 hfsvol *hfs_mount(const char *path, int pnum, int mode)
 {
-  hfsvol *vol, *check;
+  return hfs_mountx(path, pnum, mode, 0);
+}
 
-  /* see if the volume is already mounted */
+/*
+ * NAME:	findvol()
+ * DESCRIPTION:	locate a compatible mounted volume (hfs_mountlock held)
+ */
+static
+hfsvol *findvol(const char *path, int pnum, int mode)
+{
+  hfsvol *check;
 
   for (check = hfs_mounts; check; check = check->next)
     {
       if (check->pnum == pnum && v_same(check, path) == 1)
 	{
+	  int readonly;
+
 	  /* verify compatible read/write mode */
 
-	  if (((check->flags & HFS_VOL_READONLY) &&
-	       ! (mode & HFS_MODE_RDWR)) ||
-	      (! (check->flags & HFS_VOL_READONLY) &&
-	       (mode & (HFS_MODE_RDWR | HFS_MODE_ANY))))
-	    {
-	      vol = check;
-	      goto done;
-	    }
+	  v_lock(check);
+	  readonly = check->flags & HFS_VOL_READONLY;
+	  v_unlock(check);
+
+	  if ((readonly && ! (mode & HFS_MODE_RDWR)) ||
+	      (! readonly && (mode & (HFS_MODE_RDWR | HFS_MODE_ANY))))
+	    return check;
 	}
     }
 
+  return 0;
+}
+
+/*
+ * NAME:	hfs->mountx()
+ * DESCRIPTION:	open an HFS volume with tuning options
+ */
+hfsvol *hfs_mountx(const char *path, int pnum, int mode,
+		   const hfsmountopts *opts)
+{
+  hfsvol *vol = 0, *check;
+
+  /* serialize mounts so a medium is never mounted twice at once */
+
+  pthread_mutex_lock(&medialock);
+
+  /* see if the volume is already mounted */
+
+  pthread_mutex_lock(&hfs_mountlock);
+
+  check = findvol(path, pnum, mode);
+  if (check)
+    goto done;
+
+  pthread_mutex_unlock(&hfs_mountlock);
+
+  /* the medium is opened and mounted without holding hfs_mountlock */
+
   vol = ALLOC(hfsvol, 1);
   if (vol == 0)
     ERROR(ENOMEM, 0);
 
   v_init(vol, mode);
 
+  if (opts)
+    vol->opts = *opts;
+
   /* open the medium */
 
   switch (mode & HFS_MODE_MASK)
@@ -148,6 +217,12 @@ hfsvol *hfs_mount(const char *path, int pnum, int mode)
       v_mount(vol) == -1)
     goto fail;
 
+  if (vol->opts.wbinterval && ! (vol->flags & HFS_VOL_READONLY) &&
+      v_startwb(vol) == -1)
+    goto fail;
+
+  pthread_mutex_lock(&hfs_mountlock);
+
   /* add to linked list of volumes */
 
   vol->prev = 0;
@@ -157,20 +232,29 @@ hfsvol *hfs_mount(const char *path, int pnum, int mode)
     hfs_mounts->prev = vol;
 
   hfs_mounts = vol;
+  check = vol;
 
 done:
-  ++vol->refs;
-  curvol = vol;
+  ++check->refs;
+  curvol = check;
 
-  return vol;
+  pthread_mutex_unlock(&hfs_mountlock);
+  pthread_mutex_unlock(&medialock);
+
+  return check;
 
 fail:
   if (vol)
     {
+      v_stopwb(vol);
       v_close(vol);
+
+      pthread_mutex_destroy(&vol->lock);
       FREE(vol);
     }
 
+  pthread_mutex_unlock(&medialock);
+
   return 0;
 }
 
@@ -182,7 +266,7 @@ int hfs_flush(hfsvol *vol)
 {
   hfsfile *file;
 
-  if (getvol(&vol) == -1)
+  if (lockvol(&vol, 0) == -1)
     goto fail;
 
   for (file = vol->files; file; file = file->next)
@@ -194,9 +278,13 @@ int hfs_flush(hfsvol *vol)
   if (v_flush(vol) == -1)
     goto fail;
 
+  v_unlock(vol);
+
   return 0;
 
 fail:
+  v_unlock(vol);
+
   return -1;
 }
 
@@ -208,8 +296,12 @@ void hfs_flushall(void)
 {
   hfsvol *vol;
 
+  pthread_mutex_lock(&hfs_mountlock);
+
   for (vol = hfs_mounts; vol; vol = vol->next)
     hfs_flush(vol);
+
+  pthread_mutex_unlock(&hfs_mountlock);
 }
 
 /*
@@ -223,12 +315,43 @@ int hfs_umount(hfsvol *vol)
   if (getvol(&vol) == -1)
     goto fail;
 
+  /* a concurrent mount must not read the medium while it is closed */
+
+  pthread_mutex_lock(&medialock);
+  pthread_mutex_lock(&hfs_mountlock);
+
   if (--vol->refs)
     {
+      pthread_mutex_unlock(&hfs_mountlock);
+      pthread_mutex_unlock(&medialock);
+
+      v_lock(vol);
       result = v_flush(vol);
+      v_unlock(vol);
+
       goto done;
     }
 
+  /* remove from linked list of volumes */
+
+  if (vol->prev)
+    vol->prev->next = vol->next;
+  if (vol->next)
+    vol->next->prev = vol->prev;
+
+  if (vol == hfs_mounts)
+    hfs_mounts = vol->next;
+  if (vol == curvol)
+    curvol = 0;
+
+  pthread_mutex_unlock(&hfs_mountlock);
+
+  /* the write-back thread must finish without the lock held */
+
+  v_stopwb(vol);
+
+  v_lock(vol);
+
   /* close all open files and directories */
 
   while (vol->files)
@@ -248,20 +371,13 @@ int hfs_umount(hfsvol *vol)
   if (v_close(vol) == -1)
     result = -1;
 
-  /* remove from linked list of volumes */
-
-  if (vol->prev)
-    vol->prev->next = vol->next;
-  if (vol->next)
-    vol->next->prev = vol->prev;
-
-  if (vol == hfs_mounts)
-    hfs_mounts = vol->next;
-  if (vol == curvol)
-    curvol = 0;
+  v_unlock(vol);
 
+  pthread_mutex_destroy(&vol->lock);
   FREE(vol);
 
+  pthread_mutex_unlock(&medialock);
+
 done:
   return result;
 
@@ -275,8 +391,19 @@ fail:
  */
 void hfs_umountall(void)
 {
-  while (hfs_mounts)
-    hfs_umount(hfs_mounts);
+  hfsvol *vol;
+
+  while (1)
+    {
+      pthread_mutex_lock(&hfs_mountlock);
+      vol = hfs_mounts;
+      pthread_mutex_unlock(&hfs_mountlock);
+
+      if (vol == 0)
+	break;
+
+      hfs_umount(vol);
+    }
 }
 
 /*
@@ -287,16 +414,28 @@ hfsvol *hfs_getvol(const char *name)
 {
   hfsvol *vol;
 
-  if (name == 0)
-    return curvol;
+  pthread_mutex_lock(&hfs_mountlock);
 
-  for (vol = hfs_mounts; vol; vol = vol->next)
+  if (name == 0)
+    vol = curvol;
+  else
     {
-      if (d_relstring(name, vol->mdb.drVN) == 0)
-	return vol;
+      for (vol = hfs_mounts; vol; vol = vol->next)
+	{
+	  int cmp;
+
+	  v_lock(vol);
+	  cmp = d_relstring(name, vol->mdb.drVN);
+	  v_unlock(vol);
+
+	  if (cmp == 0)
+	    break;
+	}
     }
 
-  return 0;
+  pthread_mutex_unlock(&hfs_mountlock);
+
+  return vol;
 }
 
 /*
@@ -305,7 +444,9 @@ hfsvol *hfs_getvol(const char *name)
  */
 void hfs_setvol(hfsvol *vol)
 {
+  pthread_mutex_lock(&hfs_mountlock);
   curvol = vol;
+  pthread_mutex_unlock(&hfs_mountlock);
 }
 
 /*
@@ -314,7 +455,7 @@ void hfs_setvol(hfsvol *vol)
  */
 int hfs_vstat(hfsvol *vol, hfsvolent *ent)
 {
-  if (getvol(&vol) == -1)
+  if (lockvol(&vol, 0) == -1)
     goto fail;
 
   strcpy(ent->name, vol->mdb.drVN);
@@ -336,6 +477,8 @@ int hfs_vstat(hfsvol *vol, hfsvolent *ent)
 
   ent->blessed   = vol->mdb.drFndrInfo[0];
 
+  v_unlock(vol);
+
   return 0;
 
 fail:
@@ -348,7 +491,7 @@ fail:
  */
 int hfs_vsetattr(hfsvol *vol, hfsvolent *ent)
 {
-  if (getvol(&vol) == -1)
+  if (lockvol(&vol, 0) == -1)
     goto fail;
 
   if (ent->clumpsz % vol->mdb.drAlBlkSiz != 0)
@@ -373,6 +516,40 @@ int hfs_vsetattr(hfsvol *vol, hfsvolent *ent)
 
   vol->flags |= HFS_VOL_UPDATE_MDB;
 
+  v_unlock(vol);
+
+  return 0;
+
+fail:
+  v_unlock(vol);
+
+  return -1;
+}
+
+/*
+ * NAME:	hfs->cachestat()
+ * DESCRIPTION:	return block cache statistics
+ */
+int hfs_cachestat(hfsvol *vol, hfscachestat *stat)
+{
+  if (lockvol(&vol, 0) == -1)
+    goto fail;
+
+  if (vol->cache)
+    {
+      stat->cachesz = (unsigned long) vol->cache->size << HFS_BLOCKSZ_BITS;
+      stat->hits    = vol->cache->hits;
+      stat->misses  = vol->cache->misses;
+    }
+  else
+    {
+      stat->cachesz = 0;
+      stat->hits    = 0;
+      stat->misses  = 0;
+    }
+
+  v_unlock(vol);
+
   return 0;
 
 fail:
@@ -389,7 +566,7 @@ int hfs_chdir(hfsvol *vol, const char *path)
 {
   CatDataRec data;
 
-  if (getvol(&vol) == -1 ||
+  if (lockvol(&vol, path) == -1 ||
       v_resolve(&vol, path, &data, 0, 0, 0) <= 0)
     goto fail;
 
@@ -398,9 +575,13 @@ int hfs_chdir(hfsvol *vol, const char *path)
 
   vol->cwd = data.u.dir.dirDirID;
 
+  v_unlock(vol);
+
   return 0;
 
 fail:
+  v_unlock(vol);
+
   return -1;
 }
 
@@ -410,10 +591,16 @@ fail:
  */
 unsigned long hfs_getcwd(hfsvol *vol)
 {
-  if (getvol(&vol) == -1)
+  unsigned long cwd;
+
+  if (lockvol(&vol, 0) == -1)
     return 0;
 
-  return vol->cwd;
+  cwd = vol->cwd;
+
+  v_unlock(vol);
+
+  return cwd;
 }
 
 /*
@@ -422,7 +609,7 @@ unsigned long hfs_getcwd(hfsvol *vol)
  */
 int hfs_setcwd(hfsvol *vol, unsigned long id)
 {
-  if (getvol(&vol) == -1)
+  if (lockvol(&vol, 0) == -1)
     goto fail;
 
   if (id == vol->cwd)
@@ -436,9 +623,13 @@ int hfs_setcwd(hfsvol *vol, unsigned long id)
   vol->cwd = id;
 
 done:
+  v_unlock(vol);
+
   return 0;
 
 fail:
+  v_unlock(vol);
+
   return -1;
 }
 
@@ -450,7 +641,7 @@ int hfs_dirinfo(hfsvol *vol, unsigned long *id, char *name)
 {
   CatDataRec thread;
 
-  if (getvol(&vol) == -1 ||
+  if (lockvol(&vol, 0) == -1 ||
       v_getdthread(vol, *id, &thread, 0) <= 0)
     goto fail;
 
@@ -459,9 +650,13 @@ int hfs_dirinfo(hfsvol *vol, unsigned long *id, char *name)
   if (name)
     strcpy(name, thread.u.dthd.thdCName);
 
+  v_unlock(vol);
+
   return 0;
 
 fail:
+  v_unlock(vol);
+
   return -1;
 }
 
@@ -472,25 +667,34 @@ fail:
 hfsdir *hfs_opendir(hfsvol *vol, const char *path)
 {
   hfsdir *dir = 0;
+  hfsvol *first;
   CatKeyRec key;
   CatDataRec data;
   byte pkey[HFS_CATKEYLEN];
 
-  if (getvol(&vol) == -1)
+  /* the volume list must not be locked while holding a volume lock */
+
+  pthread_mutex_lock(&hfs_mountlock);
+  first = hfs_mounts;
+  pthread_mutex_unlock(&hfs_mountlock);
+
+  if (lockvol(&vol, path) == -1)
     goto fail;
 
   dir = ALLOC(hfsdir, 1);
   if (dir == 0)
     ERROR(ENOMEM, 0);
 
-  dir->vol = vol;
+  dir->vol  = vol;
+  dir->scan = 0;
+  dir->err  = 0;
 
   if (*path == 0)
     {
       /* meta-directory containing root dirs from all mounted volumes */
 
       dir->dirid = 0;
-      dir->vptr  = hfs_mounts;
+      dir->vptr  = first;
     }
   else
     {
@@ -518,48 +722,75 @@ hfsdir *hfs_opendir(hfsvol *vol, const char *path)
 
   vol->dirs = dir;
 
+  v_unlock(vol);
+
   return dir;
 
 fail:
+  v_unlock(vol);
+
   FREE(dir);
   return 0;
 }
 
 /*
- * NAME:	hfs->readdir()
- * DESCRIPTION:	return the next entry in the directory
+ * NAME:	hfs->opencatalog()
+ * DESCRIPTION:	prepare to read every entry in a volume's catalog
  */
-int hfs_readdir(hfsdir *dir, hfsdirent *ent)
+hfsdir *hfs_opencatalog(hfsvol *vol)
 {
-  CatKeyRec key;
-  CatDataRec data;
-  const byte *ptr;
+  hfsdir *dir = 0;
 
-  if (dir->dirid == 0)
-    {
-      hfsvol *vol;
-      char cname[HFS_MAX_FLEN + 1];
+  if (lockvol(&vol, 0) == -1)
+    goto fail;
 
-      for (vol = hfs_mounts; vol; vol = vol->next)
-	{
-	  if (vol == dir->vptr)
-	    break;
-	}
+  dir = ALLOC(hfsdir, 1);
+  if (dir == 0)
+    ERROR(ENOMEM, 0);
 
-      if (vol == 0)
-	ERROR(ENOENT, "no more entries");
+  dir->vol   = vol;
+  dir->dirid = HFS_CNID_ROOTPAR;
+  dir->scan  = 1;
+  dir->vptr  = 0;
+  dir->err   = 0;
 
-      if (v_getdthread(vol, HFS_CNID_ROOTDIR, &data, 0) <= 0 ||
-	  v_catsearch(vol, HFS_CNID_ROOTPAR, data.u.dthd.thdCName,
-		      &data, cname, 0) <= 0)
-	goto fail;
+  /* start before the first leaf node, which is read on the first call */
 
-      r_unpackdirent(HFS_CNID_ROOTPAR, cname, &data, ent);
+  dir->n.bt          = &vol->cat;
+  dir->n.nnum        = 0;
+  dir->n.nd.ndFLink  = vol->cat.hdr.bthFNode;
+  dir->n.nd.ndNRecs  = 0;
+  dir->n.rnum        = (vol->cat.hdr.bthFNode == 0) ? -1 : 0;
 
-      dir->vptr = vol->next;
+  dir->prev = 0;
+  dir->next = vol->dirs;
 
-      goto done;
-    }
+  if (vol->dirs)
+    vol->dirs->prev = dir;
+
+  vol->dirs = dir;
+
+  v_unlock(vol);
+
+  return dir;
+
+fail:
+  v_unlock(vol);
+
+  FREE(dir);
+  return 0;
+}
+
+/*
+ * NAME:	nextent()
+ * DESCRIPTION:	advance a (locked) directory to its next catalog entry
+ */
+static
+int nextent(hfsdir *dir, hfsdirent *ent)
+{
+  CatKeyRec key;
+  CatDataRec data;
+  const byte *ptr;
 
   if (dir->n.rnum == -1)
     ERROR(ENOENT, "no more entries");
@@ -576,6 +807,8 @@ int hfs_readdir(hfsdir *dir, hfsdirent *ent)
 	      ERROR(ENOENT, "no more entries");
 	    }
 
+	  bt_prefetch(dir->n.bt, dir->n.nd.ndFLink);
+
 	  if (bt_getnode(&dir->n, dir->n.bt, dir->n.nd.ndFLink) == -1)
 	    {
 	      dir->n.rnum = -1;
@@ -589,20 +822,21 @@ int hfs_readdir(hfsdir *dir, hfsdirent *ent)
 
       r_unpackcatkey(ptr, &key);
 
-      if (key.ckrParID != dir->dirid)
+      if (! dir->scan && key.ckrParID != dir->dirid)
 	{
 	  dir->n.rnum = -1;
 	  ERROR(ENOENT, "no more entries");
 	}
 
-      r_unpackcatdata(HFS_RECDATA(ptr), &data);
+      /* thread records are skipped without being unpacked */
 
-      switch (data.cdrType)
+      switch ((signed char) *HFS_RECDATA(ptr))
 	{
 	case cdrDirRec:
 	case cdrFilRec:
+	  r_unpackcatdata(HFS_RECDATA(ptr), &data);
 	  r_unpackdirent(key.ckrParID, key.ckrCName, &data, ent);
-	  goto done;
+	  return 0;
 
 	case cdrThdRec:
 	case cdrFThdRec:
@@ -614,9 +848,138 @@ int hfs_readdir(hfsdir *dir, hfsdirent *ent)
 	}
     }
 
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	hfs->readdir()
+ * DESCRIPTION:	return the next entry in the directory
+ */
+int hfs_readdir(hfsdir *dir, hfsdirent *ent)
+{
+  hfsvol *lvol = 0;
+  CatDataRec data;
+
+  /* report an error held back by hfs_readdir_many() */
+
+  if (dir->err)
+    {
+      hfs_error = dir->errstr;
+      errno = dir->err;
+      dir->err = 0;
+
+      return -1;
+    }
+
+  if (dir->dirid == 0)
+    {
+      hfsvol *vol;
+      char cname[HFS_MAX_FLEN + 1];
+
+      /* hold the volume list so the volume can't be unmounted under us */
+
+      pthread_mutex_lock(&hfs_mountlock);
+
+      for (vol = hfs_mounts; vol; vol = vol->next)
+	{
+	  if (vol == dir->vptr)
+	    break;
+	}
+
+      if (vol == 0)
+	ERROR(ENOENT, "no more entries");
+
+      lvol = vol;
+      v_lock(lvol);
+
+      if (v_getdthread(vol, HFS_CNID_ROOTDIR, &data, 0) <= 0 ||
+	  v_catsearch(vol, HFS_CNID_ROOTPAR, data.u.dthd.thdCName,
+		      &data, cname, 0) <= 0)
+	goto fail;
+
+      r_unpackdirent(HFS_CNID_ROOTPAR, cname, &data, ent);
+
+      dir->vptr = vol->next;
+
+      goto done;
+    }
+
+  lvol = dir->vol;
+  v_lock(lvol);
+
+  if (nextent(dir, ent) == -1)
+    goto fail;
+
 done:
+  v_unlock(lvol);
+
+  if (dir->dirid == 0)
+    pthread_mutex_unlock(&hfs_mountlock);
+
   return 0;
 
+fail:
+  v_unlock(lvol);
+
+  if (dir->dirid == 0)
+    pthread_mutex_unlock(&hfs_mountlock);
+
+  return -1;
+}
+
+/*
+ * NAME:	hfs->readdir_many()
+ * DESCRIPTION:	return up to n of the next entries in the directory
+ */
+int hfs_readdir_many(hfsdir *dir, hfsdirent *ents, int n)
+{
+  int count = 0;
+
+  if (n < 1)
+    ERROR(EINVAL, "bad entry count");
+
+  /* report an error held back from the previous call */
+
+  if (dir->err)
+    {
+      hfs_error = dir->errstr;
+      errno = dir->err;
+      dir->err = 0;
+
+      goto fail;
+    }
+
+  if (dir->dirid == 0)
+    {
+      /* the meta-directory has only one entry per mounted volume */
+
+      while (count < n && hfs_readdir(dir, &ents[count]) == 0)
+	++count;
+    }
+  else
+    {
+      v_lock(dir->vol);
+
+      while (count < n && nextent(dir, &ents[count]) == 0)
+	++count;
+
+      v_unlock(dir->vol);
+    }
+
+  if (count < n && errno != ENOENT)
+    {
+      if (count == 0)
+	goto fail;
+
+      /* return the entries already consumed; fail on the next call */
+
+      dir->err    = errno;
+      dir->errstr = hfs_error;
+    }
+
+  return count;
+
 fail:
   return -1;
 }
@@ -629,6 +992,8 @@ int hfs_closedir(hfsdir *dir)
 {
   hfsvol *vol = dir->vol;
 
+  v_lock(vol);
+
   if (dir->prev)
     dir->prev->next = dir->next;
   if (dir->next)
@@ -636,6 +1001,8 @@ int hfs_closedir(hfsdir *dir)
   if (dir == vol->dirs)
     vol->dirs = dir->next;
 
+  v_unlock(vol);
+
   FREE(dir);
 
   return 0;
@@ -658,7 +1025,7 @@ hfsfile *hfs_create(hfsvol *vol, const char *path,
   unsigned reclen;
   int found;
 
-  if (getvol(&vol) == -1)
+  if (lockvol(&vol, path) == -1)
     goto fail;
 
   file = ALLOC(hfsfile, 1);
@@ -714,9 +1081,13 @@ hfsfile *hfs_create(hfsvol *vol, const char *path,
 
   vol->files = file;
 
+  v_unlock(vol);
+
   return file;
 
 fail:
+  v_unlock(vol);
+
   FREE(file);
   return 0;
 }
@@ -729,7 +1100,7 @@ hfsfile *hfs_open(hfsvol *vol, const char *path)
 {
   hfsfile *file = 0;
 
-  if (getvol(&vol) == -1)
+  if (lockvol(&vol, path) == -1)
     goto fail;
 
   file = ALLOC(hfsfile, 1);
@@ -747,6 +1118,9 @@ hfsfile *hfs_open(hfsvol *vol, const char *path)
   file->vol   = vol;
   file->flags = 0;
 
+  file->map   = 0;
+  file->mapsz = 0;
+
   f_selectfork(file, fkData);
 
   file->prev = 0;
@@ -757,9 +1131,13 @@ hfsfile *hfs_open(hfsvol *vol, const char *path)
 
   vol->files = file;
 
+  v_unlock(vol);
+
   return file;
 
 fail:
+  v_unlock(vol);
+
   FREE(file);
   return 0;
 }
@@ -772,11 +1150,15 @@ int hfs_setfork(hfsfile *file, int fork)
 {
   int result = 0;
 
+  v_lock(file->vol);
+
   if (f_trunc(file) == -1)
     result = -1;
 
   f_selectfork(file, fork ? fkRsrc : fkData);
 
+  v_unlock(file->vol);
+
   return result;
 }
 
@@ -798,6 +1180,8 @@ unsigned long hfs_read(hfsfile *file, void *buf, unsigned long len)
   unsigned long *lglen, count;
   byte *ptr = buf;
 
+  v_lock(file->vol);
+
   f_getptrs(file, 0, &lglen, 0);
 
   if (file->pos + len > *lglen)
@@ -815,7 +1199,28 @@ unsigned long hfs_read(hfsfile *file, void *buf, unsigned long len)
       if (chunk > count)
 	chunk = count;
 
-      if (offs == 0 && chunk == HFS_BLOCKSZ)
+      if (offs == 0 && chunk == HFS_BLOCKSZ &&
+	  (count >= (HFS_BLOCKBUFSZ << HFS_BLOCKSZ_BITS) ||
+	   file->vol->cache == 0))
+	{
+	  unsigned int lpa = file->vol->lpa, anum, alen;
+	  unsigned long blen;
+
+	  /* read whole blocks directly, one contiguous extent at a time */
+
+	  if (f_locate(file, bnum / lpa, &anum, &alen) == -1)
+	    goto fail;
+
+	  blen = (unsigned long) alen * lpa - bnum % lpa;
+	  if (blen > (count >> HFS_BLOCKSZ_BITS))
+	    blen = count >> HFS_BLOCKSZ_BITS;
+
+	  if (b_readabs(file->vol, anum, bnum % lpa, (block *) ptr, blen) == -1)
+	    goto fail;
+
+	  chunk = blen << HFS_BLOCKSZ_BITS;
+	}
+      else if (offs == 0 && chunk == HFS_BLOCKSZ)
 	{
 	  if (f_getblock(file, bnum, (block *) ptr) == -1)
 	    goto fail;
@@ -836,9 +1241,13 @@ unsigned long hfs_read(hfsfile *file, void *buf, unsigned long len)
       count     -= chunk;
     }
 
+  v_unlock(file->vol);
+
   return len;
 
 fail:
+  v_unlock(file->vol);
+
   return -1;
 }
 
@@ -851,6 +1260,8 @@ unsigned long hfs_write(hfsfile *file, const void *buf, unsigned long len)
   unsigned long *lglen, *pylen, count;
   const byte *ptr = buf;
 
+  v_lock(file->vol);
+
   if (file->vol->flags & HFS_VOL_READONLY)
     ERROR(EROFS, 0);
 
@@ -877,29 +1288,71 @@ unsigned long hfs_write(hfsfile *file, const void *buf, unsigned long len)
       if (chunk > count)
 	chunk = count;
 
-      if (file->pos + chunk > *pylen)
+      if (offs == 0 && chunk == HFS_BLOCKSZ &&
+	  (count >= (HFS_BLOCKBUFSZ << HFS_BLOCKSZ_BITS) ||
+	   file->vol->cache == 0))
 	{
-	  if (bt_space(&file->vol->ext, 1) == -1 ||
-	      f_alloc(file) == -1)
+	  unsigned int lpa = file->vol->lpa, anum, alen;
+	  unsigned long blen;
+
+	  /* write whole blocks directly, one contiguous extent at a time */
+
+	  blen = count >> HFS_BLOCKSZ_BITS;
+
+	  while (file->pos + (blen << HFS_BLOCKSZ_BITS) > *pylen)
+	    {
+	      if (bt_space(&file->vol->ext, 1) == -1 ||
+		  f_alloc(file) == -1)
+		{
+		  const char *str = hfs_error;
+		  int err = errno;
+
+		  /* release what was reserved beyond the logical EOF */
+
+		  f_trunc(file);
+
+		  ERROR(err, str);
+		}
+	    }
+
+	  if (f_locate(file, bnum / lpa, &anum, &alen) == -1)
 	    goto fail;
-	}
 
-      if (offs == 0 && chunk == HFS_BLOCKSZ)
-	{
-	  if (f_putblock(file, bnum, (block *) ptr) == -1)
+	  if (blen > (unsigned long) alen * lpa - bnum % lpa)
+	    blen = (unsigned long) alen * lpa - bnum % lpa;
+
+	  if (b_writeabs(file->vol, anum, bnum % lpa,
+			 (const block *) ptr, blen) == -1)
 	    goto fail;
+
+	  chunk = blen << HFS_BLOCKSZ_BITS;
 	}
       else
 	{
-	  block b;
+	  if (file->pos + chunk > *pylen)
+	    {
+	      if (bt_space(&file->vol->ext, 1) == -1 ||
+		  f_alloc(file) == -1)
+		goto fail;
+	    }
 
-	  if (f_getblock(file, bnum, &b) == -1)
-	    goto fail;
+	  if (offs == 0 && chunk == HFS_BLOCKSZ)
+	    {
+	      if (f_putblock(file, bnum, (block *) ptr) == -1)
+		goto fail;
+	    }
+	  else
+	    {
+	      block b;
 
-	  memcpy(b + offs, ptr, chunk);
+	      if (f_getblock(file, bnum, &b) == -1)
+		goto fail;
 
-	  if (f_putblock(file, bnum, &b) == -1)
-	    goto fail;
+	      memcpy(b + offs, ptr, chunk);
+
+	      if (f_putblock(file, bnum, &b) == -1)
+		goto fail;
+	    }
 	}
 
       ptr += chunk;
@@ -911,9 +1364,13 @@ unsigned long hfs_write(hfsfile *file, const void *buf, unsigned long len)
 	*lglen = file->pos;
     }
 
+  v_unlock(file->vol);
+
   return len;
 
 fail:
+  v_unlock(file->vol);
+
   return -1;
 }
 
@@ -925,6 +1382,8 @@ int hfs_truncate(hfsfile *file, unsigned long len)
 {
   unsigned long *lglen;
 
+  v_lock(file->vol);
+
   f_getptrs(file, 0, &lglen, 0);
 
   if (*lglen > len)
@@ -941,9 +1400,13 @@ int hfs_truncate(hfsfile *file, unsigned long len)
 	file->pos = len;
     }
 
+  v_unlock(file->vol);
+
   return 0;
 
 fail:
+  v_unlock(file->vol);
+
   return -1;
 }
 
@@ -1001,6 +1464,8 @@ int hfs_close(hfsfile *file)
   hfsvol *vol = file->vol;
   int result = 0;
 
+  v_lock(vol);
+
   if (f_trunc(file) == -1 ||
       f_flush(file) == -1)
     result = -1;
@@ -1012,6 +1477,9 @@ int hfs_close(hfsfile *file)
   if (file == vol->files)
     vol->files = file->next;
 
+  v_unlock(vol);
+
+  f_freemap(file);
   FREE(file);
 
   return result;
@@ -1029,15 +1497,19 @@ int hfs_stat(hfsvol *vol, const char *path, hfsdirent *ent)
   unsigned long parid;
   char name[HFS_MAX_FLEN + 1];
 
-  if (getvol(&vol) == -1 ||
+  if (lockvol(&vol, path) == -1 ||
       v_resolve(&vol, path, &data, &parid, name, 0) <= 0)
     goto fail;
 
   r_unpackdirent(parid, name, &data, ent);
 
+  v_unlock(vol);
+
   return 0;
 
 fail:
+  v_unlock(vol);
+
   return -1;
 }
 
@@ -1061,7 +1533,7 @@ int hfs_setattr(hfsvol *vol, const char *path, const hfsdirent *ent)
   CatDataRec data;
   node n;
 
-  if (getvol(&vol) == -1 ||
+  if (lockvol(&vol, path) == -1 ||
       v_resolve(&vol, path, &data, 0, 0, &n) <= 0)
     goto fail;
 
@@ -1070,9 +1542,16 @@ int hfs_setattr(hfsvol *vol, const char *path, const hfsdirent *ent)
 
   r_packdirent(&data, ent);
 
-  return v_putcatrec(&data, &n);
+  if (v_putcatrec(&data, &n) == -1)
+    goto fail;
+
+  v_unlock(vol);
+
+  return 0;
 
 fail:
+  v_unlock(vol);
+
   return -1;
 }
 
@@ -1082,6 +1561,8 @@ fail:
  */
 int hfs_fsetattr(hfsfile *file, const hfsdirent *ent)
 {
+  v_lock(file->vol);
+
   if (file->vol->flags & HFS_VOL_READONLY)
     ERROR(EROFS, 0);
 
@@ -1089,9 +1570,13 @@ int hfs_fsetattr(hfsfile *file, const hfsdirent *ent)
 
   file->flags |= HFS_FILE_UPDATE_CATREC;
 
+  v_unlock(file->vol);
+
   return 0;
 
 fail:
+  v_unlock(file->vol);
+
   return -1;
 }
 
@@ -1106,7 +1591,7 @@ int hfs_mkdir(hfsvol *vol, const char *path)
   char name[HFS_MAX_FLEN + 1];
   int found;
 
-  if (getvol(&vol) == -1)
+  if (lockvol(&vol, path) == -1)
     goto fail;
 
   found = v_resolve(&vol, path, &data, &parid, name, 0);
@@ -1122,9 +1607,16 @@ int hfs_mkdir(hfsvol *vol, const char *path)
   if (vol->flags & HFS_VOL_READONLY)
     ERROR(EROFS, 0);
 
-  return v_mkdir(vol, parid, name);
+  if (v_mkdir(vol, parid, name) == -1)
+    goto fail;
+
+  v_unlock(vol);
+
+  return 0;
 
 fail:
+  v_unlock(vol);
+
   return -1;
 }
 
@@ -1140,7 +1632,7 @@ int hfs_rmdir(hfsvol *vol, const char *path)
   char name[HFS_MAX_FLEN + 1];
   byte pkey[HFS_CATKEYLEN];
 
-  if (getvol(&vol) == -1 ||
+  if (lockvol(&vol, path) == -1 ||
       v_resolve(&vol, path, &data, &parid, name, 0) <= 0)
     goto fail;
 
@@ -1173,9 +1665,13 @@ int hfs_rmdir(hfsvol *vol, const char *path)
       v_adjvalence(vol, parid, 1, -1) == -1)
     goto fail;
 
+  v_unlock(vol);
+
   return 0;
 
 fail:
+  v_unlock(vol);
+
   return -1;
 }
 
@@ -1190,7 +1686,7 @@ int hfs_delete(hfsvol *vol, const char *path)
   byte pkey[HFS_CATKEYLEN];
   int found;
 
-  if (getvol(&vol) == -1 ||
+  if (lockvol(&vol, path) == -1 ||
       v_resolve(&vol, path, &file.cat, &file.parid, file.name, 0) <= 0)
     goto fail;
 
@@ -1208,6 +1704,9 @@ int hfs_delete(hfsvol *vol, const char *path)
   file.vol   = vol;
   file.flags = 0;
 
+  file.map   = 0;
+  file.mapsz = 0;
+
   file.cat.u.fil.filLgLen  = 0;
   file.cat.u.fil.filRLgLen = 0;
 
@@ -1243,9 +1742,13 @@ int hfs_delete(hfsvol *vol, const char *path)
 	goto fail;
     }
 
+  v_unlock(vol);
+
   return 0;
 
 fail:
+  v_unlock(vol);
+
   return -1;
 }
 
@@ -1255,7 +1758,7 @@ fail:
  */
 int hfs_rename(hfsvol *vol, const char *srcpath, const char *dstpath)
 {
-  hfsvol *srcvol;
+  hfsvol *srcvol = 0;
   CatDataRec src, dst;
   unsigned long srcid, dstid;
   CatKeyRec key;
@@ -1265,20 +1768,26 @@ int hfs_rename(hfsvol *vol, const char *srcpath, const char *dstpath)
   int found, isdir, moving;
   node n;
 
-  if (getvol(&vol) == -1 ||
-      v_resolve(&vol, srcpath, &src, &srcid, srcname, 0) <= 0)
+  if (getvol(&vol) == -1)
+    goto fail;
+
+  if (v_pathvol(vol, dstpath) != v_pathvol(vol, srcpath))
+    ERROR(EINVAL, "can't move across volumes");
+
+  if (lockvol(&vol, srcpath) == -1)
     goto fail;
 
-  isdir  = (src.cdrType == cdrDirRec);
   srcvol = vol;
 
+  if (v_resolve(&vol, srcpath, &src, &srcid, srcname, 0) <= 0)
+    goto fail;
+
+  isdir  = (src.cdrType == cdrDirRec);
+
   found = v_resolve(&vol, dstpath, &dst, &dstid, dstname, 0);
   if (found == -1)
     goto fail;
 
-  if (vol != srcvol)
-    ERROR(EINVAL, "can't move across volumes");
-
   if (dstid == 0)
     ERROR(ENOENT, "bad destination path");
 
@@ -1411,9 +1920,13 @@ int hfs_rename(hfsvol *vol, const char *srcpath, const char *dstpath)
     }
 
 done:
+  v_unlock(srcvol);
+
   return 0;
 
 fail:
+  v_unlock(srcvol);
+
   return -1;
 }
 
@@ -1626,7 +2139,8 @@ int hfs_format(const char *path, int pnum, int mode, const char *vname,
 
   memset(vol.vbm, 0, vol.vbmsz << HFS_BLOCKSZ_BITS);
 
-  vol.flags |= HFS_VOL_UPDATE_VBM;
+  vol.vbmdirty = ~0UL;
+  vol.flags   |= HFS_VOL_UPDATE_VBM;
 
   /* perform initial bad block sparing */
 
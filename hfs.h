@@ -23,6 +23,14 @@
 
 # include <time.h>
 
+# if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#  define HFS_THREAD	_Thread_local
+# elif defined(__GNUC__)
+#  define HFS_THREAD	__thread
+# else
+#  error "libhfs requires thread-local storage for hfs_error"
+# endif
+
 # define HFS_BLOCKSZ		512
 # define HFS_BLOCKSZ_BITS	9
 
@@ -92,6 +100,19 @@ typedef struct {
   } u;
 } hfsdirent;
 
+typedef struct {
+  unsigned long cachesz;	/* size of block cache in bytes (0 for default) */
+  unsigned long ramax;		/* maximum read-ahead in bytes (0 for default) */
+  unsigned long wbinterval;	/* write-back period in ms (0 for none) */
+  unsigned int wbratio;		/* dirty cache percentage forcing write-back */
+} hfsmountopts;
+
+typedef struct {
+  unsigned long cachesz;	/* size of block cache in bytes */
+  unsigned long hits;		/* number of cache hits */
+  unsigned long misses;		/* number of cache misses */
+} hfscachestat;
+
 # define HFS_ISDIR		0x0001
 # define HFS_ISLOCKED		0x0002
 
@@ -116,7 +137,7 @@ typedef struct {
 # define HFS_FNDR_ISINVISIBLE		(1 << 14)
 # define HFS_FNDR_ISALIAS		(1 << 15)
 
-extern const char *hfs_error;
+extern HFS_THREAD const char *hfs_error;
 extern const unsigned char hfs_charorder[];
 
 # define HFS_MODE_RDONLY	0
@@ -128,12 +149,16 @@ extern const unsigned char hfs_charorder[];
 # define HFS_OPT_NOCACHE	0x0100
 # define HFS_OPT_2048		0x0200
 # define HFS_OPT_ZERO		0x0400
+# define HFS_OPT_MMAP		0x0800
+# define HFS_OPT_RESIDENT	0x1000
+# define HFS_OPT_INDEX		0x2000
 
 # define HFS_SEEK_SET		0
 # define HFS_SEEK_CUR		1
 # define HFS_SEEK_END		2
 
 hfsvol *hfs_mount(const char *, int, int);
+hfsvol *hfs_mountx(const char *, int, int, const hfsmountopts *);
 int hfs_flush(hfsvol *);
 void hfs_flushall(void);
 int hfs_umount(hfsvol *);
@@ -143,6 +168,7 @@ void hfs_setvol(hfsvol *);
 
 int hfs_vstat(hfsvol *, hfsvolent *);
 int hfs_vsetattr(hfsvol *, hfsvolent *);
+int hfs_cachestat(hfsvol *, hfscachestat *);
 
 int hfs_chdir(hfsvol *, const char *);
 unsigned long hfs_getcwd(hfsvol *);
@@ -151,8 +177,11 @@ int hfs_dirinfo(hfsvol *, unsigned long *, char *);
 
 hfsdir *hfs_opendir(hfsvol *, const char *);
 int hfs_readdir(hfsdir *, hfsdirent *);
+int hfs_readdir_many(hfsdir *, hfsdirent *, int);
 int hfs_closedir(hfsdir *);
 
+hfsdir *hfs_opencatalog(hfsvol *);
+
 hfsfile *hfs_create(hfsvol *, const char *, const char *, const char *);
 hfsfile *hfs_open(hfsvol *, const char *);
 int hfs_setfork(hfsfile *, int);
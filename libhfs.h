@@ -21,6 +21,8 @@
 
 #pragma once
 
+# include <pthread.h>
+
 # include "hfs.h"
 # include "apple.h"
 
@@ -60,36 +62,68 @@ typedef byte block[HFS_BLOCKSZ];
 
 typedef struct _bucket_ {
   int flags;			/* bit flags */
-  unsigned int count;		/* number of times this block is requested */
+  int list;			/* replacement list holding this bucket */
 
   unsigned long bnum;		/* logical block number */
-  block *data;			/* pointer to block contents */
+  block *data;			/* pointer to block contents (0 if ghost) */
 
-  struct _bucket_ *cnext;	/* next bucket in cache chain */
-  struct _bucket_ *cprev;	/* previous bucket in cache chain */
+  struct _bucket_ *cnext;	/* next (older) bucket in list */
+  struct _bucket_ *cprev;	/* previous (newer) bucket in list */
 
   struct _bucket_ *hnext;	/* next bucket in hash chain */
   struct _bucket_ **hprev;	/* previous bucket's pointer to this bucket */
+
+  struct _bucket_ *dnext;	/* next bucket on dirty list */
+  struct _bucket_ **dprev;	/* previous bucket's pointer to this bucket */
 } bucket;
 
 # define HFS_BUCKET_INUSE	0x01
 # define HFS_BUCKET_DIRTY	0x02
+# define HFS_BUCKET_AHEAD	0x04
+
+# define HFS_ARC_T1		0	/* resident, referenced once */
+# define HFS_ARC_T2		1	/* resident, referenced repeatedly */
+# define HFS_ARC_B1		2	/* ghosts recently evicted from T1 */
+# define HFS_ARC_B2		3	/* ghosts recently evicted from T2 */
+# define HFS_ARC_FREE		4	/* unused bucket header */
 
 # define HFS_CACHESZ		128
 # define HFS_HASHSZ		32
 # define HFS_BLOCKBUFSZ		16
+# define HFS_RAMAX		256
 
 typedef struct {
   struct _hfsvol_ *vol;		/* volume to which cache belongs */
-  bucket *tail;			/* end of bucket chain */
 
-  unsigned int hits;		/* number of cache hits */
-  unsigned int misses;		/* number of cache misses */
+  unsigned int size;		/* number of blocks in cache */
+  unsigned int hashsz;		/* number of hash slots (power of 2) */
+  unsigned int target;		/* adaptive target length of T1 list */
+
+  bucket *head[4];		/* most recently used bucket of each list */
+  unsigned int len[4];		/* number of buckets on each list */
+
+  bucket *free;			/* unused bucket headers */
+  bucket *dirty;		/* resident buckets awaiting write-back */
+  unsigned int ndirty;		/* number of buckets on dirty list */
+  block **spare;		/* unused physical blocks */
+  unsigned int nspare;		/* number of unused physical blocks */
+
+  unsigned long last;		/* most recently requested block */
+
+  unsigned int ramax;		/* maximum read-ahead window (blocks) */
+  unsigned int rawin;		/* current read-ahead window (blocks) */
+  unsigned long ranext;		/* block expected next if reading sequentially */
+
+  unsigned long hits;		/* number of cache hits */
+  unsigned long misses;		/* number of cache misses */
 
-  bucket chain[HFS_CACHESZ];	/* cache bucket chain */
-  bucket *hash[HFS_HASHSZ];	/* hash table for bucket chain */
+  bucket *chain;		/* bucket headers (2 per cached block) */
+  bucket **hash;		/* hash table for bucket headers */
+  bucket **list;		/* scratch array for sorting buckets */
+  bucket **ahead;		/* scratch array for read-ahead buckets */
+  block **bufs;			/* scratch array for vectored I/O */
 
-  block pool[HFS_CACHESZ];	/* physical blocks in cache */
+  block *pool;			/* physical blocks in cache */
 } bcache;
 
 # define HFS_MAP1SZ  256
@@ -129,6 +163,12 @@ typedef struct {
 # define HFS_ATRB_COPYPROT	(1 << 14)
 # define HFS_ATRB_SLOCKED	(1 << 15)
 
+typedef struct {
+  unsigned int fabn;		/* first file allocation block of extent */
+  unsigned int abn;		/* first volume allocation block of extent */
+  unsigned int len;		/* number of allocation blocks in extent */
+} extent;
+
 struct _hfsfile_ {
   struct _hfsvol_ *vol;		/* pointer to volume descriptor */
   unsigned long parid;		/* parent directory ID of this file */
@@ -136,6 +176,8 @@ struct _hfsfile_ {
   CatDataRec cat;		/* catalog information */
   ExtDataRec ext;		/* current extent record */
   unsigned int fabn;		/* starting file allocation block number */
+  extent *map;			/* all extents of current fork (0 if unbuilt) */
+  unsigned int mapsz;		/* number of extents in map */
   int fork;			/* current selected fork for I/O */
   unsigned long pos;		/* current file seek pointer */
   int flags;			/* bit flags */
@@ -161,16 +203,19 @@ typedef struct _node_ {
 struct _hfsdir_ {
   struct _hfsvol_ *vol;		/* associated volume */
   unsigned long dirid;		/* directory ID of interest (or 0) */
+  int scan;			/* return every entry in the catalog */
 
   node n;			/* current B*-tree node */
   struct _hfsvol_ *vptr;	/* current volume pointer */
 
+  int err;			/* errno deferred by hfs_readdir_many() */
+  const char *errstr;		/* hfs_error deferred with it */
+
   struct _hfsdir_ *prev;
   struct _hfsdir_ *next;
 };
 
-typedef void (*keyunpackfunc)(const byte *, void *);
-typedef int (*keycomparefunc)(const void *, const void *);
+typedef int (*keycomparefunc)(const byte *, const byte *);
 
 typedef struct _btree_ {
   hfsfile f;			/* subset file information */
@@ -180,12 +225,63 @@ typedef struct _btree_ {
   unsigned long mapsz;		/* number of bytes in bitmap */
   int flags;			/* bit flags */
 
-  keyunpackfunc keyunpack;	/* key unpacking function */
-  keycomparefunc keycompare;	/* key comparison function */
+  keycomparefunc keycompare;	/* packed key comparison function */
+
+  node *ncache;			/* direct-mapped cache of decoded nodes */
+  unsigned long gen;		/* bumped whenever a node is written */
+
+  block *nodes;			/* entire tree file, if held in memory */
 } btree;
 
+# define HFS_NCACHESZ		32	/* entries in node cache (power of 2) */
+# define HFS_BTPREFETCH		32	/* nodes read ahead along a leaf chain */
+
 # define HFS_BT_UPDATE_HDR	0x01
 
+typedef struct {
+  unsigned long parid;		/* parent directory ID (0 if unused) */
+  unsigned char flen;		/* length of folded name */
+  unsigned char fold[HFS_MAX_FLEN];
+				/* name folded through hfs_charorder */
+  int found;			/* 0 for a cached miss */
+  char cname[HFS_MAX_FLEN + 1];	/* name as stored in the catalog */
+  CatDataRec data;		/* catalog record data */
+} dentry;
+
+# define HFS_DCACHESZ		512	/* entries in path cache (power of 2) */
+
+typedef struct {
+  unsigned long id;		/* CNID (0 if unused) */
+  int found;			/* 0 for a cached miss */
+  CatDataRec data;		/* thread record data */
+} tentry;
+
+# define HFS_TCACHESZ		256	/* entries in thread cache (power of 2) */
+
+typedef struct {
+  unsigned long hash;		/* hash of parent ID and folded name */
+  unsigned long nnum;		/* leaf node holding the record (0 if unused) */
+  unsigned int rnum;		/* index of the record within the node */
+} centry;
+
+typedef struct {
+  unsigned int pre;		/* free blocks at the start of the range */
+  unsigned int suf;		/* free blocks at the end of the range */
+  unsigned int max;		/* longest run of free blocks in the range */
+} frange;
+
+typedef struct {
+  pthread_t thread;		/* background write-back thread */
+  pthread_mutex_t mutex;	/* protects the fields below */
+  pthread_cond_t cond;		/* signalled to wake the thread */
+  unsigned long interval;	/* write-back period (ms) */
+  unsigned int mark;		/* dirty buckets forcing early write-back */
+  int kicked;			/* early write-back has been requested */
+  int stop;			/* thread should exit */
+} wbstate;
+
+# define HFS_WBRATIO		50	/* default dirty percentage */
+
 struct _hfsvol_ {
   void *priv;		/* OS-dependent private descriptor data */
   int flags;		/* bit flags */
@@ -196,14 +292,28 @@ struct _hfsvol_ {
   unsigned int lpa;	/* number of logical blocks per allocation block */
 
   bcache *cache;	/* cache of recently used blocks */
+  hfsmountopts opts;	/* tuning options given at mount time */
+
+  pthread_mutex_t lock;	/* serializes access to volume state */
+  wbstate *wb;		/* write-back thread state (0 if none) */
 
   MDB mdb;		/* master directory block */
   block *vbm;		/* volume bitmap */
   unsigned short vbmsz;	/* number of blocks in bitmap */
+  unsigned long vbmdirty;	/* bitmap blocks changed since last write */
+  frange *ftree;	/* free-run tree over 64-block bitmap words */
+  unsigned int ftreesz;	/* number of leaves in tree (power of 2) */
 
   btree ext;		/* B*-tree control block for extents overflow file */
   btree cat;		/* B*-tree control block for catalog file */
 
+  dentry *dcache;	/* cache of resolved pathname components */
+  unsigned long dcgen;	/* catalog generation the path cache reflects */
+  tentry *tcache;	/* cache of thread records by CNID */
+  unsigned long tcgen;	/* catalog generation the thread cache reflects */
+  centry *cindex;	/* hash index of catalog keys (read-only only) */
+  unsigned long cindexsz;	/* slots in index (power of 2; 1 if unbuildable) */
+
   unsigned long cwd;	/* directory id of current working directory */
 
   int refs;		/* number of external references to this volume */
@@ -222,7 +332,9 @@ struct _hfsvol_ {
 # define HFS_VOL_UPDATE_MDB	0x0010
 # define HFS_VOL_UPDATE_ALTMDB	0x0020
 # define HFS_VOL_UPDATE_VBM	0x0040
+# define HFS_VOL_MAPPED		0x0080
 
 # define HFS_VOL_OPT_MASK	0xff00
 
 extern hfsvol *hfs_mounts;
+extern pthread_mutex_t hfs_mountlock;
@@ -22,7 +22,7 @@
 #define GETERR (hfs_error ? hfs_error : "unknown error")
 
 static const char doc_mount[] =
-    "mount(path, pnum, flags) -> hfsvol\n"
+    "mount(path, pnum, flags, cachesz=0, ramax=0, wbinterval=0, wbratio=0) -> hfsvol\n"
     "\n"
     "This routine attempts to open an HFS volume from a source pathname. The\n"
     "given `pnum' indicates which ordinal HFS partition is to be mounted,\n"
@@ -37,23 +37,63 @@ static const char doc_mount[] =
     "preference for the latter.\n"
     "\n"
     "The `flags' argument may also specify volume options. HFS_OPT_NOCACHE\n"
-    "means not to perform any internal block caching, such as would be\n"
-    "unnecessary for a volume residing in RAM, or if the associated overhead\n"
-    "is not desired. HFS_OPT_ZERO means that newly-allocated blocks should be\n"
-    "zero-initialized before use, primarily as a security feature for systems\n"
-    "on which blocks may otherwise contain random data. Neither of these\n"
-    "options should normally be necessary, and both may affect performance.\n"
+    "(0x0100) means not to perform any internal block caching, such as would\n"
+    "be unnecessary for a volume residing in RAM, or if the associated overhead\n"
+    "is not desired. HFS_OPT_ZERO (0x0400) means that newly-allocated blocks\n"
+    "should be zero-initialized before use, primarily as a security feature\n"
+    "for systems on which blocks may otherwise contain random data. Neither\n"
+    "of these options should normally be necessary, and both may affect\n"
+    "performance.\n"
+    "\n"
+    "HFS_OPT_MMAP (0x0800) requests that a volume mounted read-only be mapped\n"
+    "into memory in its entirety. Blocks are then copied directly out of the\n"
+    "mapping rather than being read from the medium and staged through the\n"
+    "internal block cache, which is bypassed. This can considerably speed up\n"
+    "access to large read-only images. The option is ignored if the volume is\n"
+    "mounted read/write, and if the medium cannot be mapped the volume is\n"
+    "accessed normally.\n"
+    "\n"
+    "HFS_OPT_RESIDENT (0x1000) requests that the catalog and extents overflow\n"
+    "files of a volume mounted read-only be read into memory in their\n"
+    "entirety when it is mounted, so that metadata lookups never touch the\n"
+    "medium or the block cache. It is likewise ignored for read/write\n"
+    "volumes, and the trees are read normally if they cannot be loaded.\n"
+    "\n"
+    "HFS_OPT_INDEX (0x2000) requests that catalog lookups on a volume mounted\n"
+    "read-only be answered from a hash table of all catalog records, built\n"
+    "on the first lookup, instead of by searching the catalog B*-tree. This\n"
+    "speeds up the resolution of many pathnames at some cost in memory. It\n"
+    "is ignored for read/write volumes.\n"
+    "\n"
+    "The optional `cachesz' keyword gives the size in bytes of the internal\n"
+    "block cache. The default is 64K; larger volumes with big catalogs may\n"
+    "benefit from a cache of several megabytes.\n"
+    "\n"
+    "The optional `ramax' keyword gives the maximum size in bytes of the\n"
+    "read-ahead window, which grows while blocks are read sequentially and\n"
+    "shrinks on random access. The default is 128K; the window is also\n"
+    "limited to a quarter of the block cache.\n"
+    "\n"
+    "The optional `wbinterval' keyword starts a background thread that\n"
+    "writes pending changes to a read/write volume every so many\n"
+    "milliseconds. The optional `wbratio' keyword gives the percentage of\n"
+    "the block cache that may be dirty before the thread is woken early;\n"
+    "the default is 50.\n"
     "\n"
     "An hfsvol object is returned. This object is used to access the volume\n"
     "and must eventually be passed to umount() to flush and close the\n"
     "volume and free all associated memory.";
 
-static PyObject *wrap_mount(PyObject *self, PyObject *args)
+static PyObject *wrap_mount(PyObject *self, PyObject *args, PyObject *kwargs)
 {
-    char *arg_path; int arg_pnum; int arg_flags;
-    if(!PyArg_ParseTuple(args, "sii", &arg_path, &arg_pnum, &arg_flags))
+    static char *kwlist[] = {"path", "pnum", "flags", "cachesz", "ramax", "wbinterval", "wbratio", NULL};
+    char *arg_path; int arg_pnum; int arg_flags; hfsmountopts arg_opts = {0};
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "sii|kkkI", kwlist, &arg_path, &arg_pnum, &arg_flags, &arg_opts.cachesz, &arg_opts.ramax, &arg_opts.wbinterval, &arg_opts.wbratio))
         {PyErr_SetString(PyExc_ValueError, "bad args"); return NULL;}
-    hfsvol *ret = hfs_mount(arg_path, arg_pnum, arg_flags);
+    hfsvol *ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = hfs_mountx(arg_path, arg_pnum, arg_flags, &arg_opts);
+    Py_END_ALLOW_THREADS
     if(!ret)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
    return PyCapsule_New((void *)ret, NAME_HFSVOL, NULL);
@@ -75,7 +115,11 @@ static PyObject *wrap_flush(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_flush(arg_vol))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_flush(arg_vol);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -88,7 +132,9 @@ static const char doc_flushall[] =
 
 static PyObject *wrap_flushall(PyObject *self, PyObject *args)
 {
+    Py_BEGIN_ALLOW_THREADS
     hfs_flushall();
+    Py_END_ALLOW_THREADS
     return Py_None;
 }
 
@@ -114,7 +160,11 @@ static PyObject *wrap_umount(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_umount(arg_vol))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_umount(arg_vol);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -130,7 +180,9 @@ static const char doc_umountall[] =
 
 static PyObject *wrap_umountall(PyObject *self, PyObject *args)
 {
+    Py_BEGIN_ALLOW_THREADS
     hfs_umountall();
+    Py_END_ALLOW_THREADS
     return Py_None;
 }
 
@@ -152,7 +204,10 @@ static PyObject *wrap_getvol(PyObject *self, PyObject *args)
     if(!PyArg_ParseTuple(args, "y", &arg_vol))
         {PyErr_SetString(PyExc_ValueError, "bad args"); return NULL;}
     if(!arg_vol[0]) arg_vol = NULL;
-    hfsvol *ret = hfs_getvol(arg_vol);
+    hfsvol *ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = hfs_getvol(arg_vol);
+    Py_END_ALLOW_THREADS
     if(!ret)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return PyCapsule_New((void *)ret, NAME_HFSVOL, NULL);
@@ -173,7 +228,9 @@ static PyObject *wrap_setvol(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
+    Py_BEGIN_ALLOW_THREADS
     hfs_setvol(arg_vol);
+    Py_END_ALLOW_THREADS
     return Py_None;
 }
 
@@ -193,7 +250,11 @@ static PyObject *wrap_vstat(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_vstat(arg_vol, &ret_volent))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_vstat(arg_vol, &ret_volent);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_BuildValue("y#", (char *)(&ret_volent), sizeof(ret_volent));
 }
@@ -220,11 +281,40 @@ static PyObject *wrap_vsetattr(PyObject *self, PyObject *args) // problems
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_vsetattr(arg_vol, arg_ent))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_vsetattr(arg_vol, arg_ent);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
 
+static const char doc_cachestat[] =
+    "cachestat(hfsvol) -> (cachesz, hits, misses)\n"
+    "\n"
+    "This routine returns the size in bytes of the volume's block cache and\n"
+    "the number of cache hits and misses since the volume was mounted. All\n"
+    "values are 0 if the volume is not using a block cache.";
+
+static PyObject *wrap_cachestat(PyObject *self, PyObject *args)
+{
+    hfsvol *arg_vol; PyObject *arg_vol_c;
+    hfscachestat ret_stat;
+    if(!PyArg_ParseTuple(args, "O", &arg_vol_c))
+        {PyErr_SetString(PyExc_ValueError, "bad args"); return NULL;}
+    if(arg_vol_c == Py_None) arg_vol = NULL;
+    else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
+        {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_cachestat(arg_vol, &ret_stat);
+    Py_END_ALLOW_THREADS
+    if(err)
+        {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
+    return Py_BuildValue("kkk", ret_stat.cachesz, ret_stat.hits, ret_stat.misses);
+}
+
 static const char doc_chdir[] =
     "chdir(hfsvol, path_bytes)\n"
     "\n"
@@ -241,7 +331,11 @@ static PyObject *wrap_chdir(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_chdir(arg_vol, arg_path))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_chdir(arg_vol, arg_path);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -278,7 +372,11 @@ static PyObject *wrap_setcwd(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_setcwd(arg_vol, arg_id))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_setcwd(arg_vol, arg_id);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -306,7 +404,11 @@ static PyObject *wrap_dirinfo(PyObject *self, PyObject *args) // returns name in
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_dirinfo(arg_vol, &argret_id, ret_name))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_dirinfo(arg_vol, &argret_id, ret_name);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_BuildValue("ly", argret_id, ret_name);
 }
@@ -333,7 +435,10 @@ static PyObject *wrap_opendir(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    hfsdir *ret = hfs_opendir(arg_vol, arg_path);
+    hfsdir *ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = hfs_opendir(arg_vol, arg_path);
+    Py_END_ALLOW_THREADS
     if(!ret)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return PyCapsule_New((void *)ret, NAME_HFSDIR, NULL);
@@ -357,13 +462,55 @@ static PyObject *wrap_readdir(PyObject *self, PyObject *args)
     if(arg_dir_c == Py_None) arg_dir = NULL;
     else if(!(arg_dir = PyCapsule_GetPointer(arg_dir_c, NAME_HFSDIR)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSDIR); return NULL;}
-    if(hfs_readdir(arg_dir, &ret_ent)) {
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_readdir(arg_dir, &ret_ent);
+    Py_END_ALLOW_THREADS
+    if(err) {
         if(errno == ENOENT) return Py_None;
         PyErr_SetString(PyExc_ValueError, GETERR); return NULL;
     }
     return Py_BuildValue("y#", (char *)(&ret_ent), sizeof(ret_ent));
 }
 
+static const char doc_readdir_many[] =
+    "readdir_many(hfsdir, n=256) -> [ent_bytes, ...]\n"
+    "\n"
+    "This function is like readdir() except that it returns a list of up to\n"
+    "`n' of the next entries in the directory, each encoded as by readdir().\n"
+    "The list is shorter than `n' only when the end of the directory has been\n"
+    "reached or an error occurred, in which case the error is raised by the\n"
+    "next call; an empty list is returned once no more entries remain.\n"
+    "`n' must be at least 1.";
+
+static PyObject *wrap_readdir_many(PyObject *self, PyObject *args)
+{
+    hfsdir *arg_dir; PyObject *arg_dir_c; int arg_n = 256;
+    hfsdirent *ret_ents; PyObject *ret;
+    int i, count;
+    if(!PyArg_ParseTuple(args, "O|i", &arg_dir_c, &arg_n) || arg_n < 1)
+        {PyErr_SetString(PyExc_ValueError, "bad args"); return NULL;}
+    if(arg_dir_c == Py_None) arg_dir = NULL;
+    else if(!(arg_dir = PyCapsule_GetPointer(arg_dir_c, NAME_HFSDIR)))
+        {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSDIR); return NULL;}
+    if(!(ret_ents = PyMem_Malloc(sizeof(hfsdirent) * arg_n)))
+        return PyErr_NoMemory();
+    Py_BEGIN_ALLOW_THREADS
+    count = hfs_readdir_many(arg_dir, ret_ents, arg_n);
+    Py_END_ALLOW_THREADS
+    if(count == -1)
+        {PyMem_Free(ret_ents); PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
+    if(!(ret = PyList_New(count)))
+        {PyMem_Free(ret_ents); return NULL;}
+    for(i = 0; i < count; i++) {
+        PyObject *ent = PyBytes_FromStringAndSize((char *)(&ret_ents[i]), sizeof(hfsdirent));
+        if(!ent) {Py_DECREF(ret); PyMem_Free(ret_ents); return NULL;}
+        PyList_SET_ITEM(ret, i, ent);
+    }
+    PyMem_Free(ret_ents);
+    return ret;
+}
+
 static const char doc_closedir[] =
     "closedir(hfsdir)\n"
     "\n"
@@ -380,11 +527,70 @@ static PyObject *wrap_closedir(PyObject *self, PyObject *args)
     if(arg_dir_c == Py_None) arg_dir = NULL;
     else if(!(arg_dir = PyCapsule_GetPointer(arg_dir_c, NAME_HFSDIR)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSDIR); return NULL;}
-    if(hfs_closedir(arg_dir))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_closedir(arg_dir);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
 
+static const char doc_catalog[] =
+    "catalog(hfsvol) -> iterator of (parid, name_bytes, ent_bytes)\n"
+    "\n"
+    "This function returns an iterator over every file and directory on the\n"
+    "volume, read in one sequential pass over the catalog leaf nodes. Each\n"
+    "item gives the CNID of the parent directory, the entry's name and the\n"
+    "entry itself as encoded by readdir(). Items are grouped by parent in\n"
+    "catalog key order. The iterator must not be used once the volume has\n"
+    "been unmounted.";
+
+static PyObject *catalog_next(PyObject *arg_dir_c, PyObject *unused)
+{
+    hfsdir *arg_dir; hfsdirent ret_ent; int err;
+    if(!(arg_dir = PyCapsule_GetPointer(arg_dir_c, NAME_HFSDIR)))
+        return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_readdir(arg_dir, &ret_ent);
+    if(err && errno == ENOENT)
+        hfs_closedir(arg_dir);
+    Py_END_ALLOW_THREADS
+    if(err) {
+        if(errno == ENOENT) Py_RETURN_NONE; // sentinel; never called again
+        PyErr_SetString(PyExc_ValueError, GETERR); return NULL;
+    }
+    return Py_BuildValue("kyy#", ret_ent.parid, ret_ent.name, (char *)(&ret_ent), sizeof(ret_ent));
+}
+
+static PyMethodDef catalog_next_def = {"catalog_next", catalog_next, METH_NOARGS, NULL};
+
+static PyObject *wrap_catalog(PyObject *self, PyObject *args)
+{
+    hfsvol *arg_vol; PyObject *arg_vol_c;
+    PyObject *dir_c, *next, *ret;
+    if(!PyArg_ParseTuple(args, "O", &arg_vol_c))
+        {PyErr_SetString(PyExc_ValueError, "bad args"); return NULL;}
+    if(arg_vol_c == Py_None) arg_vol = NULL;
+    else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
+        {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
+    hfsdir *dir;
+    Py_BEGIN_ALLOW_THREADS
+    dir = hfs_opencatalog(arg_vol);
+    Py_END_ALLOW_THREADS
+    if(!dir)
+        {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
+    if(!(dir_c = PyCapsule_New((void *)dir, NAME_HFSDIR, NULL)))
+        return NULL;
+    next = PyCFunction_New(&catalog_next_def, dir_c);
+    Py_DECREF(dir_c);
+    if(!next)
+        return NULL;
+    ret = PyCallIter_New(next, Py_None);
+    Py_DECREF(next);
+    return ret;
+}
+
 static const char doc_create[] =
     "create(hfsvol, path_bytes, type_bytes, creator_bytes) -> hfsfile\n"
     "\n"
@@ -409,7 +615,10 @@ static PyObject *wrap_create(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    hfsfile *ret = hfs_create(arg_vol, arg_path, arg_type, arg_creator);
+    hfsfile *ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = hfs_create(arg_vol, arg_path, arg_type, arg_creator);
+    Py_END_ALLOW_THREADS
     if(!ret)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return PyCapsule_New((void *)ret, NAME_HFSFILE, NULL);
@@ -435,7 +644,10 @@ static PyObject *wrap_open(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    hfsfile *ret = hfs_open(arg_vol, arg_path);
+    hfsfile *ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = hfs_open(arg_vol, arg_path);
+    Py_END_ALLOW_THREADS
     if(!ret)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return PyCapsule_New((void *)ret, NAME_HFSFILE, NULL);
@@ -468,7 +680,11 @@ static PyObject *wrap_setfork(PyObject *self, PyObject *args)
     if(arg_file_c == Py_None) arg_file = NULL;
     else if(!(arg_file = PyCapsule_GetPointer(arg_file_c, NAME_HFSFILE)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSFILE); return NULL;}
-    if(hfs_setfork(arg_file, arg_fork))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_setfork(arg_file, arg_fork);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -500,7 +716,9 @@ static const char doc_read[] =
     "if the end of the file is reached.\n"
     "\n"
     "It is most efficient to read data in multiples of HFS_BLOCKSZ byte\n"
-    "blocks at a time.";
+    "blocks at a time. Large reads beginning on a block boundary bypass the\n"
+    "block cache and are transferred directly into the bytearray, one\n"
+    "contiguous extent at a time.";
 
 static PyObject *wrap_read(PyObject *self, PyObject *args) // pass in a bytearray and get it shrunk!
 {
@@ -510,34 +728,77 @@ static PyObject *wrap_read(PyObject *self, PyObject *args) // pass in a bytearra
     if(arg_file_c == Py_None) arg_file = NULL;
     else if(!(arg_file = PyCapsule_GetPointer(arg_file_c, NAME_HFSFILE)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSFILE); return NULL;}
-    long bytesread = hfs_read(arg_file, PyByteArray_AsString(arg_bytearray), PyByteArray_Size(arg_bytearray));
+    Py_buffer view; long bytesread;
+    if(PyObject_GetBuffer(arg_bytearray, &view, PyBUF_WRITABLE)) // pins the bytearray while the GIL is released
+        return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    bytesread = hfs_read(arg_file, view.buf, view.len);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
     if(bytesread == -1)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     PyByteArray_Resize(arg_bytearray, bytesread);
     return Py_None;
 }
 
+static const char doc_readinto[] =
+    "readinto(hfsfile, buffer) -> bytesread\n"
+    "\n"
+    "This routine is like read() except that it fills any writable,\n"
+    "contiguous object supporting the buffer protocol (bytearray, memoryview,\n"
+    "mmap, array, ...) in place. The buffer is not resized; the number of\n"
+    "bytes actually read is returned, which is less than the size of the\n"
+    "buffer only if the end of the file is reached.\n"
+    "\n"
+    "Large block-aligned reads are transferred directly into the buffer.";
+
+static PyObject *wrap_readinto(PyObject *self, PyObject *args)
+{
+    hfsfile *arg_file; PyObject *arg_file_c; Py_buffer arg_buf;
+    if(!PyArg_ParseTuple(args, "Ow*", &arg_file_c, &arg_buf))
+        {PyErr_SetString(PyExc_ValueError, "bad args"); return NULL;}
+    if(arg_file_c == Py_None) arg_file = NULL;
+    else if(!(arg_file = PyCapsule_GetPointer(arg_file_c, NAME_HFSFILE)))
+        {PyBuffer_Release(&arg_buf); PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSFILE); return NULL;}
+    long bytesread;
+    Py_BEGIN_ALLOW_THREADS
+    bytesread = hfs_read(arg_file, arg_buf.buf, arg_buf.len);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&arg_buf);
+    if(bytesread == -1)
+        {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
+    return Py_BuildValue("l", bytesread);
+}
+
 static const char doc_write[] =
-    "write(hfsfile, bytes) -> byteswritten\n"
+    "write(hfsfile, buffer) -> byteswritten\n"
     "\n"
-    "This routine writes `bytes' to the current fork of an HFS file.\n"
+    "This routine writes the contents of `buffer', which may be any contiguous\n"
+    "object supporting the buffer protocol (bytes, bytearray, memoryview,\n"
+    "mmap, ...), to the current fork of an HFS file.\n"
     "The number of bytes actually written is returned.\n"
     "\n"
     "If the end of the file is reached before all bytes have been written,\n"
     "the file is automatically extended.\n"
     "\n"
     "It is most efficient to write data in multiples of HFS_BLOCKSZ byte\n"
-    "blocks at a time.";
+    "blocks at a time. Large writes beginning on a block boundary reserve\n"
+    "all the space they need first, then bypass the block cache and are\n"
+    "transferred directly, one contiguous extent at a time.";
 
-static PyObject *wrap_write(PyObject *self, PyObject *args) // pass in a bytearray and get it shrunk!
+static PyObject *wrap_write(PyObject *self, PyObject *args)
 {
-    hfsfile *arg_file; PyObject *arg_file_c; PyObject *arg_bytes; Py_ssize_t arg_bytes_len;
-    if(!PyArg_ParseTuple(args, "Oy#", &arg_file_c, &arg_bytes, &arg_bytes_len))
+    hfsfile *arg_file; PyObject *arg_file_c; Py_buffer arg_buf;
+    if(!PyArg_ParseTuple(args, "Oy*", &arg_file_c, &arg_buf))
         {PyErr_SetString(PyExc_ValueError, "bad args"); return NULL;}
     if(arg_file_c == Py_None) arg_file = NULL;
     else if(!(arg_file = PyCapsule_GetPointer(arg_file_c, NAME_HFSFILE)))
-        {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSFILE); return NULL;}
-    long byteswritten = hfs_write(arg_file, arg_bytes, arg_bytes_len);
+        {PyBuffer_Release(&arg_buf); PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSFILE); return NULL;}
+    long byteswritten;
+    Py_BEGIN_ALLOW_THREADS
+    byteswritten = hfs_write(arg_file, arg_buf.buf, arg_buf.len);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&arg_buf);
     if(byteswritten == -1)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_BuildValue("l", byteswritten);
@@ -561,7 +822,11 @@ static PyObject *wrap_truncate(PyObject *self, PyObject *args) // pass in a byte
     if(arg_file_c == Py_None) arg_file = NULL;
     else if(!(arg_file = PyCapsule_GetPointer(arg_file_c, NAME_HFSFILE)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSFILE); return NULL;}
-    if(hfs_truncate(arg_file, arg_len))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_truncate(arg_file, arg_len);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -620,7 +885,11 @@ static PyObject *wrap_close(PyObject *self, PyObject *args) // pass in a bytearr
     if(arg_file_c == Py_None) arg_file = NULL;
     else if(!(arg_file = PyCapsule_GetPointer(arg_file_c, NAME_HFSFILE)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSFILE); return NULL;}
-    if(hfs_close(arg_file))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_close(arg_file);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -644,7 +913,11 @@ static PyObject *wrap_stat(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_stat(arg_vol, arg_path, &ret_ent))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_stat(arg_vol, arg_path, &ret_ent);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_BuildValue("y#", (char *)(&ret_ent), sizeof(ret_ent));
 }
@@ -690,7 +963,11 @@ static PyObject *wrap_setattr(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_setattr(arg_vol, arg_path, arg_ent))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_setattr(arg_vol, arg_path, arg_ent);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -711,7 +988,11 @@ static PyObject *wrap_fsetattr(PyObject *self, PyObject *args)
     if(arg_file_c == Py_None) arg_file = NULL;
     else if(!(arg_file = PyCapsule_GetPointer(arg_file_c, NAME_HFSFILE)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSFILE); return NULL;}
-    if(hfs_fsetattr(arg_file, arg_ent))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_fsetattr(arg_file, arg_ent);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -733,7 +1014,11 @@ static PyObject *wrap_mkdir(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_mkdir(arg_vol, arg_path))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_mkdir(arg_vol, arg_path);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -754,7 +1039,11 @@ static PyObject *wrap_rmdir(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_rmdir(arg_vol, arg_path))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_rmdir(arg_vol, arg_path);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -774,7 +1063,11 @@ static PyObject *wrap_delete(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_delete(arg_vol, arg_path))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_delete(arg_vol, arg_path);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -803,7 +1096,11 @@ static PyObject *wrap_rename(PyObject *self, PyObject *args)
     if(arg_vol_c == Py_None) arg_vol = NULL;
     else if(!(arg_vol = PyCapsule_GetPointer(arg_vol_c, NAME_HFSVOL)))
         {PyErr_SetString(PyExc_ValueError, "bad " NAME_HFSVOL); return NULL;}
-    if(hfs_rename(arg_vol, arg_srcpath, arg_dstpath))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_rename(arg_vol, arg_srcpath, arg_dstpath);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -837,7 +1134,11 @@ static PyObject *wrap_zero(PyObject *self, PyObject *args)
     unsigned long ret_blocks;
     if(!PyArg_ParseTuple(args, "sI", &arg_path, &arg_maxparts))
         {PyErr_SetString(PyExc_ValueError, "bad args"); return NULL;}
-    if(hfs_zero(arg_path, arg_maxparts, &ret_blocks))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_zero(arg_path, arg_maxparts, &ret_blocks);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_BuildValue("k", ret_blocks);
 }
@@ -860,7 +1161,11 @@ static PyObject *wrap_mkpart(PyObject *self, PyObject *args)
     char *arg_path; unsigned long arg_len;
     if(!PyArg_ParseTuple(args, "sk", &arg_path, &arg_len))
         {PyErr_SetString(PyExc_ValueError, "bad args"); return NULL;}
-    if(hfs_mkpart(arg_path, arg_len))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_mkpart(arg_path, arg_len);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -885,7 +1190,9 @@ static PyObject *wrap_nparts(PyObject *self, PyObject *args)
     int ret;
     if(!PyArg_ParseTuple(args, "s", &arg_path))
         {PyErr_SetString(PyExc_ValueError, "bad args"); return NULL;}
+    Py_BEGIN_ALLOW_THREADS
     ret = hfs_nparts(arg_path);
+    Py_END_ALLOW_THREADS
     if(ret == -1)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_BuildValue("i", ret);
@@ -934,7 +1241,11 @@ static PyObject *wrap_format(PyObject *self, PyObject *args) // bad blocks unimp
     char *arg_path; int arg_pnum; int arg_mode; char *arg_vname;
     if(!PyArg_ParseTuple(args, "siiy", &arg_path, &arg_pnum, &arg_mode, &arg_vname))
         {PyErr_SetString(PyExc_ValueError, "bad args"); return NULL;}
-    if(hfs_format(arg_path, arg_pnum, arg_mode, arg_vname, 0, NULL))
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = hfs_format(arg_path, arg_pnum, arg_mode, arg_vname, 0, NULL);
+    Py_END_ALLOW_THREADS
+    if(err)
         {PyErr_SetString(PyExc_ValueError, GETERR); return NULL;}
     return Py_None;
 }
@@ -942,7 +1253,7 @@ static PyObject *wrap_format(PyObject *self, PyObject *args) // bad blocks unimp
 
 static PyMethodDef module_methods[] = {
 // Volume routines
-    {"mount", wrap_mount, METH_VARARGS, doc_mount},
+    {"mount", (PyCFunction) wrap_mount, METH_VARARGS | METH_KEYWORDS, doc_mount},
     {"flush", wrap_flush, METH_VARARGS, doc_flush},
     {"flushall", wrap_flushall, METH_NOARGS, doc_flushall},
     {"umount", wrap_umount, METH_VARARGS, doc_umount},
@@ -951,6 +1262,7 @@ static PyMethodDef module_methods[] = {
     {"setvol", wrap_setvol, METH_VARARGS, doc_setvol},
     {"vstat", wrap_vstat, METH_VARARGS, doc_vstat},
     {"vsetattr", wrap_vsetattr, METH_VARARGS, doc_vsetattr},
+    {"cachestat", wrap_cachestat, METH_VARARGS, doc_cachestat},
 // Directory routines
     {"chdir", wrap_chdir, METH_VARARGS, doc_chdir},
     {"getcwd", wrap_getcwd, METH_VARARGS, doc_getcwd},
@@ -958,13 +1270,16 @@ static PyMethodDef module_methods[] = {
     {"dirinfo", wrap_dirinfo, METH_VARARGS, doc_dirinfo},
     {"opendir", wrap_opendir, METH_VARARGS, doc_opendir},
     {"readdir", wrap_readdir, METH_VARARGS, doc_readdir},
+    {"readdir_many", wrap_readdir_many, METH_VARARGS, doc_readdir_many},
     {"closedir", wrap_closedir, METH_VARARGS, doc_closedir},
+    {"catalog", wrap_catalog, METH_VARARGS, doc_catalog},
 // File routines
     {"create", wrap_create, METH_VARARGS, doc_create},
     {"open", wrap_open, METH_VARARGS, doc_open},
     {"setfork", wrap_setfork, METH_VARARGS, doc_setfork},
     {"getfork", wrap_getfork, METH_VARARGS, doc_getfork},
     {"read", wrap_read, METH_VARARGS, doc_read},
+    {"readinto", wrap_readinto, METH_VARARGS, doc_readinto},
     {"write", wrap_write, METH_VARARGS, doc_write},
     {"truncate", wrap_truncate, METH_VARARGS, doc_truncate},
     {"seek", wrap_seek, METH_VARARGS, doc_seek},
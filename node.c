@@ -189,22 +189,54 @@ void compact(node *np)
 int n_search(node *np, const byte *pkey)
 {
   const btree *bt = np->bt;
-  byte key1[HFS_MAX_KEYLEN], key2[HFS_MAX_KEYLEN];
-  int i, comp = -1;
+  const byte *rec;
+  int lo, hi, mid, i, comp = -1;
 
-  bt->keyunpack(pkey, key2);
+  /*
+   * Records are kept in key order, so bisect the offset table. A deleted
+   * record (zero key length) has no meaningful key; should one turn up,
+   * fall back to a backward linear scan which skips over it.
+   */
 
-  for (i = np->nd.ndNRecs; i--; )
+  lo = -1;
+  hi = np->nd.ndNRecs;
+
+  while (hi - lo > 1)
     {
-      const byte *rec;
+      mid = (lo + hi) / 2;
+      rec = HFS_NODEREC(*np, mid);
+
+      if (HFS_RECKEYLEN(rec) == 0)
+	goto linear;
+
+      comp = bt->keycompare(rec, pkey);
+
+      if (comp == 0)
+	{
+	  np->rnum = mid;
+	  return 1;
+	}
+      else if (comp < 0)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  np->rnum = lo;
+
+  return 0;
+
+linear:
+  comp = -1;
 
+  for (i = np->nd.ndNRecs; i--; )
+    {
       rec = HFS_NODEREC(*np, i);
 
       if (HFS_RECKEYLEN(rec) == 0)
 	continue;  /* deleted record */
 
-      bt->keyunpack(rec, key1);
-      comp = bt->keycompare(key1, key2);
+      comp = bt->keycompare(rec, pkey);
 
       if (comp <= 0)
 	break;
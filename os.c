@@ -23,11 +23,45 @@
 #  include <unistd.h>
 
 # include <errno.h>
+# include <limits.h>
+# include <stdlib.h>
+# include <string.h>
+# include <sys/mman.h>
 # include <sys/stat.h>
+# include <sys/uio.h>
 
 # include "libhfs.h"
 # include "os.h"
 
+# ifndef IOV_MAX
+#  define IOV_MAX	16
+# endif
+
+typedef struct {
+  int fd;			/* open file descriptor */
+  const block *map;		/* read-only mapping of the medium, or 0 */
+  unsigned long mapsz;		/* size of mapping (in blocks) */
+} osdesc;
+
+/*
+ * NAME:	mapcopy()
+ * DESCRIPTION:	copy blocks out of a mapped medium
+ */
+static
+unsigned long mapcopy(const osdesc *od, void *buf, unsigned long len,
+		      unsigned long offset)
+{
+  if (offset >= od->mapsz)
+    return 0;
+
+  if (len > od->mapsz - offset)
+    len = od->mapsz - offset;
+
+  memcpy(buf, od->map + offset, len << HFS_BLOCKSZ_BITS);
+
+  return len;
+}
+
 /*
  * NAME:	os->open()
  * DESCRIPTION:	open and lock a new descriptor from the given path and mode
@@ -35,6 +69,7 @@
 int os_open(void **priv, const char *path, int mode)
 {
   int fd;
+  osdesc *od;
   struct flock lock;
 
   switch (mode)
@@ -64,7 +99,15 @@ int os_open(void **priv, const char *path, int mode)
       (errno == EACCES || errno == EAGAIN))
     ERROR(EAGAIN, "unable to obtain lock for medium");
 
-  *priv = (void *) fd;
+  od = ALLOC(osdesc, 1);
+  if (od == 0)
+    ERROR(ENOMEM, 0);
+
+  od->fd    = fd;
+  od->map   = 0;
+  od->mapsz = 0;
+
+  *priv = od;
 
   return 0;
 
@@ -81,9 +124,15 @@ fail:
  */
 int os_close(void **priv)
 {
-  int fd = (int) *priv;
+  osdesc *od = *priv;
+  int fd = od->fd;
 
-  *priv = (void *) -1;
+  *priv = 0;
+
+  if (od->map)
+    munmap((void *) od->map, od->mapsz << HFS_BLOCKSZ_BITS);
+
+  FREE(od);
 
   if (close(fd) == -1)
     ERROR(errno, "error closing medium");
@@ -100,10 +149,10 @@ fail:
  */
 int os_same(void **priv, const char *path)
 {
-  int fd = (int) *priv;
+  osdesc *od = *priv;
   struct stat fdev, dev;
 
-  if (fstat(fd, &fdev) == -1 ||
+  if (fstat(od->fd, &fdev) == -1 ||
       stat(path, &dev) == -1)
     ERROR(errno, "can't get path information");
 
@@ -114,13 +163,48 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	os->map()
+ * DESCRIPTION:	map an open read-only medium into memory for faster reads
+ */
+int os_map(void **priv)
+{
+  osdesc *od = *priv;
+  off_t size;
+  void *map;
+
+  if (od->map)
+    goto done;
+
+  size = lseek(od->fd, 0, SEEK_END);
+  if (size == -1)
+    ERROR(errno, "error seeking medium");
+
+  size &= ~(off_t) (HFS_BLOCKSZ - 1);
+  if (size == 0 || (off_t) (size_t) size != size)
+    ERROR(EINVAL, "medium cannot be mapped");
+
+  map = mmap(0, (size_t) size, PROT_READ, MAP_SHARED, od->fd, 0);
+  if (map == MAP_FAILED)
+    ERROR(errno, "error mapping medium");
+
+  od->map   = map;
+  od->mapsz = size >> HFS_BLOCKSZ_BITS;
+
+done:
+  return 0;
+
+fail:
+  return -1;
+}
+
 /*
  * NAME:	os->seek()
  * DESCRIPTION:	set a descriptor's seek pointer (offset in blocks)
  */
 unsigned long os_seek(void **priv, unsigned long offset)
 {
-  int fd = (int) *priv;
+  int fd = ((osdesc *) *priv)->fd;
   off_t result;
 
   /* offset == -1 special; seek to last block of device */
@@ -141,19 +225,36 @@ fail:
 
 /*
  * NAME:	os->read()
- * DESCRIPTION:	read blocks from an open descriptor
+ * DESCRIPTION:	read blocks from an open descriptor at a given block offset
  */
-unsigned long os_read(void **priv, void *buf, unsigned long len)
+unsigned long os_read(void **priv, void *buf, unsigned long len,
+		      unsigned long offset)
 {
-  int fd = (int) *priv;
+  osdesc *od = *priv;
+  byte *ptr = buf;
+  size_t size, done;
+  off_t pos;
   ssize_t result;
 
-  result = read(fd, buf, len << HFS_BLOCKSZ_BITS);
+  if (od->map)
+    return mapcopy(od, buf, len, offset);
 
-  if (result == -1)
-    ERROR(errno, "error reading from medium");
+  /* large transfers may be split by the system */
 
-  return (unsigned long) result >> HFS_BLOCKSZ_BITS;
+  size = (size_t) len << HFS_BLOCKSZ_BITS;
+  pos  = (off_t) offset << HFS_BLOCKSZ_BITS;
+
+  for (done = 0; done < size; done += result)
+    {
+      result = pread(od->fd, ptr + done, size - done, pos + done);
+
+      if (result == -1)
+	ERROR(errno, "error reading from medium");
+      else if (result == 0)
+	break;
+    }
+
+  return done >> HFS_BLOCKSZ_BITS;
 
 fail:
   return -1;
@@ -161,19 +262,176 @@ fail:
 
 /*
  * NAME:	os->write()
- * DESCRIPTION:	write blocks to an open descriptor
+ * DESCRIPTION:	write blocks to an open descriptor at a given block offset
  */
-unsigned long os_write(void **priv, const void *buf, unsigned long len)
+unsigned long os_write(void **priv, const void *buf, unsigned long len,
+		       unsigned long offset)
 {
-  int fd = (int) *priv;
+  int fd = ((osdesc *) *priv)->fd;
+  const byte *ptr = buf;
+  size_t size, done;
+  off_t pos;
   ssize_t result;
 
-  result = write(fd, buf, len << HFS_BLOCKSZ_BITS);
+  /* large transfers may be split by the system */
 
-  if (result == -1)
-    ERROR(errno, "error writing to medium");
+  size = (size_t) len << HFS_BLOCKSZ_BITS;
+  pos  = (off_t) offset << HFS_BLOCKSZ_BITS;
 
-  return (unsigned long) result >> HFS_BLOCKSZ_BITS;
+  for (done = 0; done < size; done += result)
+    {
+      result = pwrite(fd, ptr + done, size - done, pos + done);
+
+      if (result == -1)
+	ERROR(errno, "error writing to medium");
+      else if (result == 0)
+	break;
+    }
+
+  return done >> HFS_BLOCKSZ_BITS;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	xferv()
+ * DESCRIPTION:	transfer a whole iovec array, resuming after partial transfers
+ */
+static
+ssize_t xferv(int fd, struct iovec *iov, int n, off_t pos, int write)
+{
+  size_t done = 0;
+  ssize_t result;
+
+  while (n > 0)
+    {
+      result = write ? pwritev(fd, iov, n, pos + done) :
+		       preadv(fd, iov, n, pos + done);
+
+      if (result == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+
+	  return -1;
+	}
+      else if (result == 0)
+	break;
+
+      done += result;
+
+      /* skip the buffers completed, and trim the one partly done */
+
+      while (n > 0 && (size_t) result >= iov->iov_len)
+	{
+	  result -= iov->iov_len;
+	  ++iov, --n;
+	}
+
+      if (n > 0)
+	{
+	  iov->iov_base = (byte *) iov->iov_base + result;
+	  iov->iov_len -= result;
+	}
+    }
+
+  return done;
+}
+
+/*
+ * NAME:	os->readv()
+ * DESCRIPTION:	scatter consecutive blocks into separate buffers
+ */
+unsigned long os_readv(void **priv, block *const *bufs, unsigned int len,
+		       unsigned long offset)
+{
+  osdesc *od = *priv;
+  struct iovec iov[IOV_MAX];
+  unsigned long count = 0;
+  unsigned int n, i;
+  ssize_t result;
+
+  if (od->map)
+    {
+      for (i = 0; i < len && mapcopy(od, bufs[i], 1, offset + i); ++i)
+	continue;
+
+      return i;
+    }
+
+  while (len)
+    {
+      n = (len > IOV_MAX) ? IOV_MAX : len;
+
+      for (i = 0; i < n; ++i)
+	{
+	  iov[i].iov_base = (void *) bufs[i];
+	  iov[i].iov_len  = HFS_BLOCKSZ;
+	}
+
+      result = xferv(od->fd, iov, n, (off_t) offset << HFS_BLOCKSZ_BITS, 0);
+
+      if (result == -1)
+	ERROR(errno, "error reading from medium");
+
+      result >>= HFS_BLOCKSZ_BITS;
+      count   += result;
+
+      if ((unsigned int) result != n)
+	break;
+
+      bufs   += n;
+      len    -= n;
+      offset += n;
+    }
+
+  return count;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	os->writev()
+ * DESCRIPTION:	gather separate buffers into consecutive blocks
+ */
+unsigned long os_writev(void **priv, const block *const *bufs,
+			unsigned int len, unsigned long offset)
+{
+  int fd = ((osdesc *) *priv)->fd;
+  struct iovec iov[IOV_MAX];
+  unsigned long count = 0;
+  unsigned int n, i;
+  ssize_t result;
+
+  while (len)
+    {
+      n = (len > IOV_MAX) ? IOV_MAX : len;
+
+      for (i = 0; i < n; ++i)
+	{
+	  iov[i].iov_base = (void *) bufs[i];
+	  iov[i].iov_len  = HFS_BLOCKSZ;
+	}
+
+      result = xferv(fd, iov, n, (off_t) offset << HFS_BLOCKSZ_BITS, 1);
+
+      if (result == -1)
+	ERROR(errno, "error writing to medium");
+
+      result >>= HFS_BLOCKSZ_BITS;
+      count   += result;
+
+      if ((unsigned int) result != n)
+	break;
+
+      bufs   += n;
+      len    -= n;
+      offset += n;
+    }
+
+  return count;
 
 fail:
   return -1;
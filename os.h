@@ -26,6 +26,13 @@ int os_close(void **);
 
 int os_same(void **, const char *);
 
+int os_map(void **);
+
 unsigned long os_seek(void **, unsigned long);
-unsigned long os_read(void **, void *, unsigned long);
-unsigned long os_write(void **, const void *, unsigned long);
+
+unsigned long os_read(void **, void *, unsigned long, unsigned long);
+unsigned long os_write(void **, const void *, unsigned long, unsigned long);
+
+unsigned long os_readv(void **, block *const *, unsigned int, unsigned long);
+unsigned long os_writev(void **, const block *const *, unsigned int,
+			unsigned long);
@@ -120,6 +120,75 @@ int r_compareextkeys(const ExtKeyRec *key1, const ExtKeyRec *key2)
   return key1->xkrFABN - key2->xkrFABN;
 }
 
+/*
+ * NAME:	record->comparecatpkeys()
+ * DESCRIPTION:	compare two packed catalog record keys without unpacking
+ */
+int r_comparecatpkeys(const byte *pkey1, const byte *pkey2)
+{
+  const byte *str1, *str2;
+  unsigned int len1, len2;
+  int diff;
+
+  diff = d_getul(pkey1 + 2) - d_getul(pkey2 + 2);
+  if (diff)
+    return diff;
+
+  str1 = pkey1 + 7;
+  str2 = pkey2 + 7;
+
+  /* mirror d_fetchstr() and d_relstring() exactly */
+
+  len1 = str1[-1];
+  if (len1 >= sizeof(((CatKeyRec *) 0)->ckrCName))
+    len1 = 0;
+
+  len2 = str2[-1];
+  if (len2 >= sizeof(((CatKeyRec *) 0)->ckrCName))
+    len2 = 0;
+
+  while (len1 && len2 && *str1 && *str2)
+    {
+      diff = hfs_charorder[*str1] - hfs_charorder[*str2];
+      if (diff)
+	return diff;
+
+      ++str1, ++str2;
+      --len1, --len2;
+    }
+
+  if (len1 && ! *str1)
+    len1 = 0;
+  if (len2 && ! *str2)
+    len2 = 0;
+
+  if (! len1 && len2)
+    return -1;
+  else if (len1 && ! len2)
+    return 1;
+
+  return 0;
+}
+
+/*
+ * NAME:	record->compareextpkeys()
+ * DESCRIPTION:	compare two packed extents record keys without unpacking
+ */
+int r_compareextpkeys(const byte *pkey1, const byte *pkey2)
+{
+  int diff;
+
+  diff = d_getul(pkey1 + 2) - d_getul(pkey2 + 2);
+  if (diff)
+    return diff;
+
+  diff = pkey1[1] - pkey2[1];
+  if (diff)
+    return diff;
+
+  return d_getuw(pkey1 + 6) - d_getuw(pkey2 + 6);
+}
+
 /*
  * NAME:	record->packcatdata()
  * DESCRIPTION:	pack catalog record data
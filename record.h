@@ -30,6 +30,9 @@ void r_unpackextkey(const byte *, ExtKeyRec *);
 int r_comparecatkeys(const CatKeyRec *, const CatKeyRec *);
 int r_compareextkeys(const ExtKeyRec *, const ExtKeyRec *);
 
+int r_comparecatpkeys(const byte *, const byte *);
+int r_compareextpkeys(const byte *, const byte *);
+
 void r_packcatdata(const CatDataRec *, byte *, unsigned int *);
 void r_unpackcatdata(const byte *, CatDataRec *);
 
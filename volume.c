@@ -43,6 +43,7 @@ void v_init(hfsvol *vol, int flags)
 {
   btree *ext = &vol->ext;
   btree *cat = &vol->cat;
+  pthread_mutexattr_t attr;
 
   vol->priv       = 0;
   vol->flags      = flags & HFS_VOL_OPT_MASK;
@@ -54,8 +55,25 @@ void v_init(hfsvol *vol, int flags)
 
   vol->cache      = 0;
 
+  vol->opts.cachesz    = 0;
+  vol->opts.ramax      = 0;
+  vol->opts.wbinterval = 0;
+  vol->opts.wbratio    = 0;
+
+  /* the lock is recursive since library calls may nest */
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&vol->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  vol->wb         = 0;
+
   vol->vbm        = 0;
   vol->vbmsz      = 0;
+  vol->vbmdirty   = 0;
+  vol->ftree      = 0;
+  vol->ftreesz    = 0;
 
   f_init(&ext->f, vol, HFS_CNID_EXT, "extents overflow");
 
@@ -63,8 +81,10 @@ void v_init(hfsvol *vol, int flags)
   ext->mapsz      = 0;
   ext->flags      = 0;
 
-  ext->keyunpack  = (keyunpackfunc)  r_unpackextkey;
-  ext->keycompare = (keycomparefunc) r_compareextkeys;
+  ext->keycompare = r_compareextpkeys;
+  ext->ncache     = 0;
+  ext->gen        = 0;
+  ext->nodes      = 0;
 
   f_init(&cat->f, vol, HFS_CNID_CAT, "catalog");
 
@@ -72,8 +92,17 @@ void v_init(hfsvol *vol, int flags)
   cat->mapsz      = 0;
   cat->flags      = 0;
 
-  cat->keyunpack  = (keyunpackfunc)  r_unpackcatkey;
-  cat->keycompare = (keycomparefunc) r_comparecatkeys;
+  cat->keycompare = r_comparecatpkeys;
+  cat->ncache     = 0;
+  cat->gen        = 0;
+  cat->nodes      = 0;
+
+  vol->dcache     = 0;
+  vol->dcgen      = 0;
+  vol->tcache     = 0;
+  vol->cindex     = 0;
+  vol->cindexsz   = 0;
+  vol->tcgen      = 0;
 
   vol->cwd        = HFS_CNID_ROOTDIR;
 
@@ -85,6 +114,25 @@ void v_init(hfsvol *vol, int flags)
   vol->next       = 0;
 }
 
+/*
+ * NAME:	vol->lock()
+ * DESCRIPTION:	acquire exclusive access to a volume
+ */
+void v_lock(hfsvol *vol)
+{
+  pthread_mutex_lock(&vol->lock);
+}
+
+/*
+ * NAME:	vol->unlock()
+ * DESCRIPTION:	release access to a volume (if any)
+ */
+void v_unlock(hfsvol *vol)
+{
+  if (vol)
+    pthread_mutex_unlock(&vol->lock);
+}
+
 /*
  * NAME:	vol->open()
  * DESCRIPTION:	open volume source and lock against concurrent updates
@@ -99,9 +147,15 @@ int v_open(hfsvol *vol, const char *path, int mode)
 
   vol->flags |= HFS_VOL_OPEN;
 
-  /* initialize volume block cache (OK to fail) */
+  /* map read-only medium into memory if requested (OK to fail) */
 
-  if (! (vol->flags & HFS_OPT_NOCACHE) &&
+  if (mode == HFS_MODE_RDONLY && (vol->flags & HFS_OPT_MMAP) &&
+      os_map(&vol->priv) != -1)
+    vol->flags |= HFS_VOL_MAPPED;
+
+  /* initialize volume block cache (OK to fail; unnecessary if mapped) */
+
+  if (! (vol->flags & (HFS_OPT_NOCACHE | HFS_VOL_MAPPED)) &&
       b_init(vol) != -1)
     vol->flags |= HFS_VOL_USINGCACHE;
 
@@ -169,6 +223,153 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	writeback()
+ * DESCRIPTION:	body of a volume's background write-back thread
+ */
+static
+void *writeback(void *arg)
+{
+  hfsvol *vol = arg;
+  wbstate *wb = vol->wb;
+  struct timespec ts;
+
+  pthread_mutex_lock(&wb->mutex);
+
+  while (! wb->stop)
+    {
+      if (! wb->kicked)
+	{
+	  clock_gettime(CLOCK_REALTIME, &ts);
+
+	  ts.tv_sec  += wb->interval / 1000;
+	  ts.tv_nsec += (wb->interval % 1000) * 1000000L;
+
+	  if (ts.tv_nsec >= 1000000000L)
+	    {
+	      ++ts.tv_sec;
+	      ts.tv_nsec -= 1000000000L;
+	    }
+
+	  pthread_cond_timedwait(&wb->cond, &wb->mutex, &ts);
+
+	  if (wb->stop)
+	    break;
+	}
+
+      wb->kicked = 0;
+
+      pthread_mutex_unlock(&wb->mutex);
+
+      /* errors are left for the next explicit flush to report */
+
+      v_lock(vol);
+      v_flush(vol);
+      v_unlock(vol);
+
+      pthread_mutex_lock(&wb->mutex);
+    }
+
+  pthread_mutex_unlock(&wb->mutex);
+
+  return 0;
+}
+
+/*
+ * NAME:	vol->startwb()
+ * DESCRIPTION:	start a background thread to write back pending changes
+ */
+int v_startwb(hfsvol *vol)
+{
+  wbstate *wb;
+  unsigned int ratio;
+
+  ASSERT(vol->wb == 0);
+
+  wb = ALLOC(wbstate, 1);
+  if (wb == 0)
+    ERROR(ENOMEM, 0);
+
+  ratio = vol->opts.wbratio;
+  if (ratio == 0 || ratio > 100)
+    ratio = HFS_WBRATIO;
+
+  wb->interval = vol->opts.wbinterval;
+  wb->mark     = vol->cache ? vol->cache->size * ratio / 100 : 0;
+  wb->kicked   = 0;
+  wb->stop     = 0;
+
+  pthread_mutex_init(&wb->mutex, 0);
+  pthread_cond_init(&wb->cond, 0);
+
+  vol->wb = wb;
+
+  if (pthread_create(&wb->thread, 0, writeback, vol) != 0)
+    {
+      vol->wb = 0;
+
+      pthread_cond_destroy(&wb->cond);
+      pthread_mutex_destroy(&wb->mutex);
+      FREE(wb);
+
+      ERROR(EAGAIN, "can't start write-back thread");
+    }
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	vol->stopwb()
+ * DESCRIPTION:	stop a volume's write-back thread, if any
+ */
+void v_stopwb(hfsvol *vol)
+{
+  wbstate *wb = vol->wb;
+
+  /* the caller must not hold the volume lock */
+
+  if (wb == 0)
+    return;
+
+  pthread_mutex_lock(&wb->mutex);
+  wb->stop = 1;
+  pthread_cond_signal(&wb->cond);
+  pthread_mutex_unlock(&wb->mutex);
+
+  pthread_join(wb->thread, 0);
+
+  vol->wb = 0;
+
+  pthread_cond_destroy(&wb->cond);
+  pthread_mutex_destroy(&wb->mutex);
+  FREE(wb);
+}
+
+/*
+ * NAME:	vol->kickwb()
+ * DESCRIPTION:	ask the write-back thread to run now
+ */
+void v_kickwb(hfsvol *vol)
+{
+  wbstate *wb = vol->wb;
+
+  if (wb == 0)
+    return;
+
+  pthread_mutex_lock(&wb->mutex);
+
+  if (! wb->kicked)
+    {
+      wb->kicked = 1;
+      pthread_cond_signal(&wb->cond);
+    }
+
+  pthread_mutex_unlock(&wb->mutex);
+}
+
 /*
  * NAME:	vol->close()
  * DESCRIPTION:	close access path to volume source
@@ -191,21 +392,50 @@ int v_close(hfsvol *vol)
   if (os_close(&vol->priv) == -1)
     result = -1;
 
-  vol->flags &= ~(HFS_VOL_OPEN | HFS_VOL_MOUNTED | HFS_VOL_USINGCACHE);
+  vol->flags &= ~(HFS_VOL_OPEN | HFS_VOL_MOUNTED | HFS_VOL_USINGCACHE |
+		  HFS_VOL_MAPPED);
 
   /* free dynamically allocated structures */
 
   FREE(vol->vbm);
+  FREE(vol->ftree);
 
-  vol->vbm   = 0;
-  vol->vbmsz = 0;
+  vol->vbm      = 0;
+  vol->vbmsz    = 0;
+  vol->vbmdirty = 0;
+  vol->ftree    = 0;
+  vol->ftreesz = 0;
 
   FREE(vol->ext.map);
   FREE(vol->cat.map);
 
+  f_freemap(&vol->ext.f);
+  f_freemap(&vol->cat.f);
+
   vol->ext.map = 0;
   vol->cat.map = 0;
 
+  FREE(vol->ext.ncache);
+  FREE(vol->cat.ncache);
+
+  vol->ext.ncache = 0;
+  vol->cat.ncache = 0;
+
+  FREE(vol->ext.nodes);
+  FREE(vol->cat.nodes);
+
+  vol->ext.nodes  = 0;
+  vol->cat.nodes  = 0;
+
+  FREE(vol->dcache);
+  FREE(vol->tcache);
+  FREE(vol->cindex);
+
+  vol->dcache   = 0;
+  vol->tcache   = 0;
+  vol->cindex   = 0;
+  vol->cindexsz = 0;
+
 done:
   return result;
 }
@@ -402,15 +632,20 @@ fail:
 int v_writevbm(hfsvol *vol)
 {
   unsigned int vbmst = vol->mdb.drVBMSt;
-  unsigned int vbmsz = vol->vbmsz;
-  const block *bp;
+  unsigned int i;
 
-  for (bp = vol->vbm; vbmsz--; ++bp)
+  /* only the blocks touched since the last write need to go out */
+
+  for (i = 0; i < vol->vbmsz; ++i)
     {
-      if (b_writelb(vol, vbmst++, bp) == -1)
+      if (! (vol->vbmdirty & (1UL << i)))
+	continue;
+
+      if (b_writelb(vol, vbmst + i, &vol->vbm[i]) == -1)
 	goto fail;
     }
 
+  vol->vbmdirty = 0;
   vol->flags &= ~HFS_VOL_UPDATE_VBM;
 
   return 0;
@@ -444,6 +679,13 @@ int v_mount(hfsvol *vol)
   else
     vol->mdb.drAtrb &= ~HFS_ATRB_HLOCKED;
 
+  /* hold both trees in memory if requested; failure is not fatal */
+
+  if ((vol->flags & HFS_VOL_READONLY) &&
+      (vol->flags & HFS_OPT_RESIDENT) &&
+      bt_load(&vol->ext) != -1)
+    bt_load(&vol->cat);
+
   vol->flags |= HFS_VOL_MOUNTED;
 
   return 0;
@@ -477,6 +719,143 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	keyhash()
+ * DESCRIPTION:	hash a packed catalog key; keys comparing equal hash equal
+ */
+static
+unsigned long keyhash(const byte *pkey)
+{
+  const byte *str = pkey + 7;
+  unsigned long hash;
+  unsigned int len;
+
+  hash = d_getul(pkey + 2);
+
+  /* fold exactly as r_comparecatpkeys() compares */
+
+  len = str[-1];
+  if (len >= sizeof(((CatKeyRec *) 0)->ckrCName))
+    len = 0;
+
+  for (; len && *str; ++str, --len)
+    hash = hash * 31 + hfs_charorder[*str];
+
+  return hash;
+}
+
+/*
+ * NAME:	buildindex()
+ * DESCRIPTION:	hash every catalog leaf record by key
+ */
+static
+int buildindex(hfsvol *vol)
+{
+  btree *bt = &vol->cat;
+  unsigned long size, mask, i;
+  centry *index = 0, *ep;
+  node n;
+
+  for (size = 64; size < (bt->hdr.bthNRecs << 1); size <<= 1)
+    continue;
+
+  index = ALLOC(centry, size);
+  if (index == 0)
+    ERROR(ENOMEM, 0);
+
+  mask = size - 1;
+
+  for (i = 0; i < size; ++i)
+    index[i].nnum = 0;
+
+  n.nnum       = 0;
+  n.nd.ndFLink = bt->hdr.bthFNode;
+
+  while (n.nd.ndFLink)
+    {
+      bt_prefetch(bt, n.nd.ndFLink);
+
+      if (bt_getnode(&n, bt, n.nd.ndFLink) == -1)
+	goto fail;
+
+      if (n.nd.ndType != ndLeafNode)
+	ERROR(EIO, "non-leaf node in catalog leaf chain");
+
+      for (n.rnum = 0; n.rnum < n.nd.ndNRecs; ++n.rnum)
+	{
+	  unsigned long hash;
+	  unsigned long count = 0;
+
+	  hash = keyhash(HFS_NODEREC(n, n.rnum));
+
+	  for (i = hash & mask; index[i].nnum; i = (i + 1) & mask)
+	    {
+	      if (++count == size)
+		ERROR(EIO, "too many catalog records");
+	    }
+
+	  ep = &index[i];
+
+	  ep->hash = hash;
+	  ep->nnum = n.nnum;
+	  ep->rnum = n.rnum;
+	}
+    }
+
+  vol->cindex   = index;
+  vol->cindexsz = size;
+
+  return 0;
+
+fail:
+  FREE(index);
+  return -1;
+}
+
+/*
+ * NAME:	isearch()
+ * DESCRIPTION:	find a catalog record through the HFS_OPT_INDEX hash index
+ */
+static
+int isearch(hfsvol *vol, const byte *pkey, node *np, int wantpos)
+{
+  unsigned long hash, mask, i;
+  const centry *ep;
+
+  /* build the index on first use; if that fails, never try again */
+
+  if (vol->cindexsz == 0 &&
+      buildindex(vol) == -1)
+    vol->cindexsz = 1;
+
+  if (vol->cindex == 0)
+    return bt_search(&vol->cat, pkey, np);
+
+  hash = keyhash(pkey);
+  mask = vol->cindexsz - 1;
+
+  for (i = hash & mask; vol->cindex[i].nnum; i = (i + 1) & mask)
+    {
+      ep = &vol->cindex[i];
+
+      if (ep->hash != hash)
+	continue;
+
+      if (bt_getnode(np, &vol->cat, ep->nnum) == -1)
+	return -1;
+
+      if (vol->cat.keycompare(pkey, HFS_NODEREC(*np, ep->rnum)) == 0)
+	{
+	  np->rnum = ep->rnum;
+	  return 1;
+	}
+    }
+
+  /* a caller wanting the insertion point must still descend the tree */
+
+  return wantpos ? bt_search(&vol->cat, pkey, np) : 0;
+}
+
 /*
  * NAME:	vol->catsearch()
  * DESCRIPTION:	search catalog tree
@@ -488,7 +867,7 @@ int v_catsearch(hfsvol *vol, unsigned long parid, const char *name,
   byte pkey[HFS_CATKEYLEN];
   const byte *ptr;
   node n;
-  int found;
+  int found, wantpos = (np != 0);
 
   if (np == 0)
     np = &n;
@@ -496,7 +875,12 @@ int v_catsearch(hfsvol *vol, unsigned long parid, const char *name,
   r_makecatkey(&key, parid, name);
   r_packcatkey(&key, pkey, 0);
 
-  found = bt_search(&vol->cat, pkey, np);
+  if ((vol->flags & HFS_VOL_READONLY) &&
+      (vol->flags & HFS_OPT_INDEX))
+    found = isearch(vol, pkey, np, wantpos);
+  else
+    found = bt_search(&vol->cat, pkey, np);
+
   if (found <= 0)
     return found;
 
@@ -557,6 +941,40 @@ int v_extsearch(hfsfile *file, unsigned int fabn,
   return 1;
 }
 
+/*
+ * NAME:	tslot()
+ * DESCRIPTION:	return the thread cache slot for a CNID, or 0
+ */
+static
+tentry *tslot(hfsvol *vol, unsigned long id)
+{
+  unsigned int i;
+
+  /* any catalog write may have added or removed a thread */
+
+  if (vol->tcache && vol->tcgen != vol->cat.gen)
+    {
+      for (i = 0; i < HFS_TCACHESZ; ++i)
+	vol->tcache[i].id = 0;
+
+      vol->tcgen = vol->cat.gen;
+    }
+
+  if (vol->tcache == 0)
+    {
+      vol->tcache = ALLOC(tentry, HFS_TCACHESZ);
+      if (vol->tcache == 0)
+	return 0;
+
+      for (i = 0; i < HFS_TCACHESZ; ++i)
+	vol->tcache[i].id = 0;
+
+      vol->tcgen = vol->cat.gen;
+    }
+
+  return &vol->tcache[id & (HFS_TCACHESZ - 1)];
+}
+
 /*
  * NAME:	vol->getthread()
  * DESCRIPTION:	retrieve catalog thread information for a file or directory
@@ -565,12 +983,39 @@ int v_getthread(hfsvol *vol, unsigned long id,
 		CatDataRec *thread, node *np, int type)
 {
   CatDataRec rec;
+  tentry *tp = 0;
   int found;
 
   if (thread == 0)
     thread = &rec;
 
-  found = v_catsearch(vol, id, "", thread, 0, np);
+  /* callers wanting the node itself must search the tree */
+
+  if (np == 0 && id != 0)
+    tp = tslot(vol, id);
+
+  if (tp && tp->id == id)
+    {
+      found = tp->found;
+      if (found)
+	*thread = tp->data;
+    }
+  else
+    {
+      found = v_catsearch(vol, id, "", thread, 0, np);
+      if (found == -1)
+	goto fail;
+
+      if (tp)
+	{
+	  tp->id    = id;
+	  tp->found = found;
+
+	  if (found)
+	    tp->data = *thread;
+	}
+    }
+
   if (found == 1 && thread->cdrType != type)
     ERROR(EIO, "bad thread record");
 
@@ -615,72 +1060,432 @@ int v_putextrec(const ExtDataRec *data, node *np)
 }
 
 /*
- * NAME:	vol->allocblocks()
- * DESCRIPTION:	allocate a contiguous range of blocks
+ * NAME:	bmword()
+ * DESCRIPTION:	fetch 64 consecutive bits of a bitmap, first bit in the MSB
  */
-int v_allocblocks(hfsvol *vol, ExtDescriptor *blocks)
+static
+unsigned long long bmword(const byte *map, unsigned int w)
 {
-  unsigned int request, found, foundat, start, end;
-  register unsigned int pt;
-  block *vbm;
-  int wrap = 0;
+  const byte *ptr = map + (w << 3);
+
+  return ((unsigned long long) ptr[0] << 56) |
+	 ((unsigned long long) ptr[1] << 48) |
+	 ((unsigned long long) ptr[2] << 40) |
+	 ((unsigned long long) ptr[3] << 32) |
+	 ((unsigned long long) ptr[4] << 24) |
+	 ((unsigned long long) ptr[5] << 16) |
+	 ((unsigned long long) ptr[6] <<  8) |
+	 ((unsigned long long) ptr[7]);
+}
 
-  if (vol->mdb.drFreeBks == 0)
-    ERROR(ENOSPC, "volume full");
+/*
+ * NAME:	lead0()
+ * DESCRIPTION:	count leading zero bits of a non-zero word
+ */
+static
+unsigned int lead0(unsigned long long word)
+{
+# ifdef __GNUC__
+  return __builtin_clzll(word);
+# else
+  unsigned int n = 0;
 
-  request = blocks->xdrNumABlks;
-  found   = 0;
-  foundat = 0;
-  start   = vol->mdb.drAllocPtr;
-  end     = vol->mdb.drNmAlBlks;
-  vbm     = vol->vbm;
+  while (! (word & 0x8000000000000000ULL))
+    word <<= 1, ++n;
 
-  ASSERT(request > 0);
+  return n;
+# endif
+}
 
-  /* backtrack the start pointer to recover unused space */
+/*
+ * NAME:	trail0()
+ * DESCRIPTION:	count trailing zero bits of a non-zero word
+ */
+static
+unsigned int trail0(unsigned long long word)
+{
+# ifdef __GNUC__
+  return __builtin_ctzll(word);
+# else
+  unsigned int n = 0;
+
+  while (! (word & 1))
+    word >>= 1, ++n;
 
-  if (! BMTST(vbm, start))
+  return n;
+# endif
+}
+
+/*
+ * NAME:	bmscan()
+ * DESCRIPTION:	return first bit in [pt, end) with the given state, or end
+ */
+static
+unsigned int bmscan(const block *bm, unsigned int pt, unsigned int end,
+		    int set)
+{
+  const byte *map = (const byte *) bm;
+  unsigned long long word;
+
+  while (pt < end)
     {
-      while (start > 0 && ! BMTST(vbm, start - 1))
-	--start;
+      word = bmword(map, pt >> 6);
+      if (! set)
+	word = ~word;
+
+      word &= ~0ULL >> (pt & 0x3f);
+      if (word)
+	{
+	  pt = (pt & ~0x3fU) + lead0(word);
+	  return pt < end ? pt : end;
+	}
+
+      pt = (pt & ~0x3fU) + 64;
     }
 
-  /* find largest unused block which satisfies request */
+  return end;
+}
 
-  pt = start;
+/*
+ * NAME:	bmrscan()
+ * DESCRIPTION:	return one past the last bit before pt with the given state
+ */
+static
+unsigned int bmrscan(const block *bm, unsigned int pt, int set)
+{
+  const byte *map = (const byte *) bm;
+  unsigned long long word;
+  unsigned int w, k;
 
-  while (1)
+  while (pt > 0)
     {
-      unsigned int mark;
+      w = (pt - 1) >> 6;
+      k = pt - (w << 6);
 
-      /* skip blocks in use */
+      word = bmword(map, w);
+      if (! set)
+	word = ~word;
 
-      while (pt < end && BMTST(vbm, pt))
-	++pt;
+      if (k < 64)
+	word &= ~(~0ULL >> k);
 
-      if (wrap && pt >= start)
-	break;
+      if (word)
+	return (w << 6) + 64 - trail0(word);
+
+      pt = w << 6;
+    }
+
+  return 0;
+}
+
+/*
+ * NAME:	bmfill()
+ * DESCRIPTION:	set or clear a range of bits
+ */
+static
+void bmfill(block *bm, unsigned int pt, unsigned int len, int set)
+{
+  byte *map = (byte *) bm;
+
+  for ( ; len && (pt & 0x07); ++pt, --len)
+    {
+      if (set)
+	BMSET(map, pt);
+      else
+	BMCLR(map, pt);
+    }
+
+  if (len >= 8)
+    {
+      memset(map + (pt >> 3), set ? 0xff : 0x00, len >> 3);
+
+      pt  += len & ~0x07U;
+      len &= 0x07;
+    }
+
+  for ( ; len; ++pt, --len)
+    {
+      if (set)
+	BMSET(map, pt);
+      else
+	BMCLR(map, pt);
+    }
+}
+
+/*
+ * NAME:	bmcount()
+ * DESCRIPTION:	count clear bits in [0, end)
+ */
+static
+unsigned int bmcount(const block *bm, unsigned int end)
+{
+  const byte *map = (const byte *) bm;
+  unsigned long long word;
+  unsigned int w, count = 0;
+
+  for (w = 0; w << 6 < end; ++w)
+    {
+      word = ~bmword(map, w);
+
+      if (end - (w << 6) < 64)
+	word &= ~(~0ULL >> (end - (w << 6)));
+
+# ifdef __GNUC__
+      count += __builtin_popcountll(word);
+# else
+      for ( ; word; word &= word - 1)
+	++count;
+# endif
+    }
+
+  return count;
+}
+
+/*
+ * NAME:	vbmtouch()
+ * DESCRIPTION:	note which bitmap blocks a changed range of bits lies in
+ */
+static
+void vbmtouch(hfsvol *vol, unsigned int pt, unsigned int len)
+{
+  unsigned int first, last;
+
+  if (len == 0)
+    return;
+
+  first = pt >> 12;
+  last  = (pt + len - 1) >> 12;
+
+  for ( ; first <= last; ++first)
+    vol->vbmdirty |= 1UL << first;
+}
+
+/*
+ * NAME:	ftleaf()
+ * DESCRIPTION:	summarize the free runs in one 64-block bitmap word
+ */
+static
+void ftleaf(hfsvol *vol, unsigned int w)
+{
+  frange *fp = &vol->ftree[vol->ftreesz + w];
+  unsigned long long word, free;
+  unsigned int end = vol->mdb.drNmAlBlks;
+
+  /* blocks past the end of the volume count as used */
+
+  word = bmword((const byte *) vol->vbm, w);
+  if (end - (w << 6) < 64)
+    word |= ~0ULL >> (end - (w << 6));
+
+  if (word == 0)
+    {
+      fp->pre = fp->suf = fp->max = 64;
+      return;
+    }
+
+  fp->pre = lead0(word);
+  fp->suf = trail0(word);
+
+  for (fp->max = 0, free = ~word; free; ++fp->max)
+    free &= free << 1;
+}
+
+/*
+ * NAME:	ftjoin()
+ * DESCRIPTION:	recompute an interior node of the free-run tree
+ */
+static
+void ftjoin(hfsvol *vol, unsigned int i, unsigned int len)
+{
+  frange *fp = &vol->ftree[i];
+  const frange *lp = &vol->ftree[2 * i], *rp = &vol->ftree[2 * i + 1];
+
+  len >>= 1;  /* length of each half */
+
+  fp->pre = (lp->pre == len) ? len + rp->pre : lp->pre;
+  fp->suf = (rp->suf == len) ? len + lp->suf : rp->suf;
+
+  fp->max = lp->suf + rp->pre;
+  if (lp->max > fp->max)
+    fp->max = lp->max;
+  if (rp->max > fp->max)
+    fp->max = rp->max;
+}
+
+/*
+ * NAME:	ftupdate()
+ * DESCRIPTION:	refresh the free-run tree after a bitmap range has changed
+ */
+static
+void ftupdate(hfsvol *vol, unsigned int pt, unsigned int len)
+{
+  unsigned int lo, hi, i, span;
+
+  if (vol->ftree == 0 || len == 0)
+    return;
+
+  lo = pt >> 6;
+  hi = (pt + len - 1) >> 6;
+
+  for (i = lo; i <= hi; ++i)
+    ftleaf(vol, i);
+
+  lo += vol->ftreesz;
+  hi += vol->ftreesz;
+
+  for (span = 128; lo > 1; span <<= 1)
+    {
+      lo >>= 1;
+      hi >>= 1;
+
+      for (i = lo; i <= hi; ++i)
+	ftjoin(vol, i, span);
+    }
+}
+
+/*
+ * NAME:	ftbuild()
+ * DESCRIPTION:	construct the free-run tree from the volume bitmap
+ */
+static
+int ftbuild(hfsvol *vol)
+{
+  unsigned int nwords;
+
+  nwords = (vol->mdb.drNmAlBlks + 63) >> 6;
+
+  for (vol->ftreesz = 1; vol->ftreesz < nwords; vol->ftreesz <<= 1)
+    continue;
+
+  vol->ftree = ALLOC(frange, 2 * vol->ftreesz);
+  if (vol->ftree == 0)
+    ERROR(ENOMEM, 0);
+
+  memset(vol->ftree, 0, SIZE(frange, 2 * vol->ftreesz));
+
+  if (nwords)
+    ftupdate(vol, 0, nwords << 6);
+
+  return 0;
+
+fail:
+  return -1;
+}
+
+/*
+ * NAME:	ftfind()
+ * DESCRIPTION:	find the first run of at least k free blocks starting at lo
+ */
+static
+int ftfind(const hfsvol *vol, unsigned int i, unsigned int base,
+	   unsigned int len, unsigned int lo, unsigned int k,
+	   unsigned int *run, unsigned int *at)
+{
+  const frange *fp = &vol->ftree[i];
 
-      /* count blocks not in use */
+  /* *run counts the free blocks (from lo) immediately preceding base */
 
-      mark = pt;
-      while (pt < end && pt - mark < request && ! BMTST(vbm, pt))
-	++pt;
+  if (base + len <= lo)
+    return 0;
 
-      if (pt - mark > found)
+  if (base >= lo)
+    {
+      if (*run + fp->pre >= k)
 	{
-	  found   = pt - mark;
-	  foundat = mark;
+	  *at = base - *run;
+	  return 1;
 	}
 
-      if (wrap && pt >= start)
-	break;
+      if (fp->max < k)
+	{
+	  *run = (fp->pre == len) ? *run + len : fp->suf;
+	  return 0;
+	}
+    }
 
-      if (pt == end)
-	pt = 0, wrap = 1;
+  if (len == 64)
+    {
+      unsigned int pt, end, q;
 
-      if (found == request)
-	break;
+      pt  = (base > lo) ? base : lo;
+      end = base + 64;
+      if (end > vol->mdb.drNmAlBlks)
+	end = vol->mdb.drNmAlBlks;
+
+      while (pt < end)
+	{
+	  q = bmscan(vol->vbm, pt, end, 1);
+
+	  if (*run + (q - pt) >= k)
+	    {
+	      *at = pt - *run;
+	      return 1;
+	    }
+
+	  *run += q - pt;
+	  if (q == end)
+	    break;
+
+	  *run = 0;
+	  pt   = bmscan(vol->vbm, q, end, 0);
+	}
+
+      if (end < base + 64)
+	*run = 0;
+
+      return 0;
+    }
+
+  return ftfind(vol, 2 * i,     base,            len >> 1, lo, k, run, at) ||
+	 ftfind(vol, 2 * i + 1, base + (len >> 1), len >> 1, lo, k, run, at);
+}
+
+/*
+ * NAME:	vol->allocblocks()
+ * DESCRIPTION:	allocate a contiguous range of blocks
+ */
+int v_allocblocks(hfsvol *vol, ExtDescriptor *blocks)
+{
+  unsigned int request, found, foundat, start, end, run;
+  block *vbm;
+
+  if (vol->mdb.drFreeBks == 0)
+    ERROR(ENOSPC, "volume full");
+
+  if (vol->ftree == 0 &&
+      ftbuild(vol) == -1)
+    goto fail;
+
+  request = blocks->xdrNumABlks;
+  found   = request;
+  foundat = 0;
+  start   = vol->mdb.drAllocPtr;
+  end     = vol->mdb.drNmAlBlks;
+  vbm     = vol->vbm;
+
+  ASSERT(request > 0);
+
+  /* backtrack the start pointer to recover unused space */
+
+  if (start < end && ! BMTST(vbm, start))
+    start = bmrscan(vbm, start, 1);
+
+  /*
+   * Take the first run which satisfies the request at or after the start
+   * pointer, wrapping around if need be; failing that, the first of the
+   * largest runs on the volume.
+   */
+
+  run = 0;
+  if (! ftfind(vol, 1, 0, vol->ftreesz << 6, start, found, &run, &foundat))
+    {
+      if (vol->ftree[1].max < found)
+	found = vol->ftree[1].max;
+
+      run = 0;
+      if (found == 0 ||
+	  ! ftfind(vol, 1, 0, vol->ftreesz << 6, 0, found, &run, &foundat))
+	found = 0;
     }
 
   if (found == 0 || found > vol->mdb.drFreeBks)
@@ -692,18 +1497,19 @@ int v_allocblocks(hfsvol *vol, ExtDescriptor *blocks)
   if (v_dirty(vol) == -1)
     goto fail;
 
-  vol->mdb.drAllocPtr = pt;
+  vol->mdb.drAllocPtr = (foundat + found < end) ? foundat + found : 0;
   vol->mdb.drFreeBks -= found;
 
-  for (pt = foundat; pt < foundat + found; ++pt)
-    BMSET(vbm, pt);
+  bmfill(vbm, foundat, found, 1);
+  ftupdate(vol, foundat, found);
+  vbmtouch(vol, foundat, found);
 
   vol->flags |= HFS_VOL_UPDATE_MDB | HFS_VOL_UPDATE_VBM;
 
   if (vol->flags & HFS_OPT_ZERO)
     {
       block b;
-      unsigned int i;
+      unsigned int pt, i;
 
       memset(&b, 0, sizeof(b));
 
@@ -726,7 +1532,7 @@ fail:
  */
 int v_freeblocks(hfsvol *vol, const ExtDescriptor *blocks)
 {
-  unsigned int start, len, pt;
+  unsigned int start, len;
   block *vbm;
 
   start = blocks->xdrStABN;
@@ -738,8 +1544,9 @@ int v_freeblocks(hfsvol *vol, const ExtDescriptor *blocks)
 
   vol->mdb.drFreeBks += len;
 
-  for (pt = start; pt < start + len; ++pt)
-    BMCLR(vbm, pt);
+  bmfill(vbm, start, len, 0);
+  ftupdate(vol, start, len);
+  vbmtouch(vol, start, len);
 
   vol->flags |= HFS_VOL_UPDATE_MDB | HFS_VOL_UPDATE_VBM;
 
@@ -749,6 +1556,123 @@ fail:
   return -1;
 }
 
+/*
+ * NAME:	dlookup()
+ * DESCRIPTION:	search the catalog through the pathname component cache
+ */
+static
+int dlookup(hfsvol *vol, unsigned long parid, const char *name,
+	    CatDataRec *data, char *cname, node *np)
+{
+  dentry *dp;
+  unsigned char fold[HFS_MAX_FLEN];
+  unsigned long hash;
+  unsigned int i, flen;
+
+  /* callers wanting the node itself must search the tree */
+
+  flen = strlen(name);
+  if (np || parid == 0 || flen > HFS_MAX_FLEN)
+    return v_catsearch(vol, parid, name, data, cname, np);
+
+  /* any catalog write may have changed what a name resolves to */
+
+  if (vol->dcache && vol->dcgen != vol->cat.gen)
+    {
+      for (i = 0; i < HFS_DCACHESZ; ++i)
+	vol->dcache[i].parid = 0;
+
+      vol->dcgen = vol->cat.gen;
+    }
+
+  if (vol->dcache == 0)
+    {
+      vol->dcache = ALLOC(dentry, HFS_DCACHESZ);
+      if (vol->dcache == 0)
+	return v_catsearch(vol, parid, name, data, cname, 0);
+
+      for (i = 0; i < HFS_DCACHESZ; ++i)
+	vol->dcache[i].parid = 0;
+
+      vol->dcgen = vol->cat.gen;
+    }
+
+  hash = parid;
+  for (i = 0; i < flen; ++i)
+    {
+      fold[i] = hfs_charorder[(unsigned char) name[i]];
+      hash    = hash * 31 + fold[i];
+    }
+
+  dp = &vol->dcache[hash & (HFS_DCACHESZ - 1)];
+
+  if (dp->parid != parid || dp->flen != flen ||
+      memcmp(dp->fold, fold, flen) != 0)
+    {
+      int found;
+
+      found = v_catsearch(vol, parid, name, &dp->data, dp->cname, 0);
+      if (found == -1)
+	{
+	  dp->parid = 0;
+	  return -1;
+	}
+
+      dp->parid = parid;
+      dp->flen  = flen;
+      dp->found = found;
+
+      memcpy(dp->fold, fold, flen);
+    }
+
+  if (dp->found)
+    {
+      if (data)
+	*data = dp->data;
+      if (cname)
+	strcpy(cname, dp->cname);
+    }
+
+  return dp->found;
+}
+
+/*
+ * NAME:	vol->pathvol()
+ * DESCRIPTION:	return the volume on which a pathname will be resolved
+ */
+hfsvol *v_pathvol(hfsvol *vol, const char *path)
+{
+  const char *ptr;
+  char name[HFS_MAX_VLEN + 1];
+  hfsvol *check;
+
+  ptr = strchr(path, ':');
+
+  if (*path == ':' || ptr == 0 || ptr - path > HFS_MAX_VLEN)
+    return vol;  /* relative path */
+
+  strncpy(name, path, ptr - path);
+  name[ptr - path] = 0;
+
+  pthread_mutex_lock(&hfs_mountlock);
+
+  for (check = hfs_mounts; check; check = check->next)
+    {
+      int cmp;
+
+      v_lock(check);
+      cmp = d_relstring(check->mdb.drVN, name);
+      v_unlock(check);
+
+      if (cmp == 0)
+	break;
+    }
+
+  pthread_mutex_unlock(&hfs_mountlock);
+
+  return check ? check : vol;
+}
+
 /*
  * NAME:	vol->resolve()
  * DESCRIPTION:	translate a pathname; return catalog information
@@ -786,8 +1710,8 @@ int v_resolve(hfsvol **vol, const char *path,
 	      if (parid)
 		*parid = data->u.dthd.thdParID;
 
-	      found = v_catsearch(*vol, data->u.dthd.thdParID,
-				  data->u.dthd.thdCName, data, fname, np);
+	      found = dlookup(*vol, data->u.dthd.thdParID,
+			      data->u.dthd.thdCName, data, fname, np);
 	      if (found == -1)
 		goto fail;
 	    }
@@ -797,24 +1721,12 @@ int v_resolve(hfsvol **vol, const char *path,
     }
   else
     {
-      hfsvol *check;
-
       dirid = HFS_CNID_ROOTPAR;  /* absolute path */
 
       if (nptr - path > HFS_MAX_VLEN)
 	ERROR(ENAMETOOLONG, 0);
 
-      strncpy(name, path, nptr - path);
-      name[nptr - path] = 0;
-
-      for (check = hfs_mounts; check; check = check->next)
-	{
-	  if (d_relstring(check->mdb.drVN, name) == 0)
-	    {
-	      *vol = check;
-	      break;
-	    }
-	}
+      /* the caller has already selected the volume with v_pathvol() */
     }
 
   while (1)
@@ -843,8 +1755,8 @@ int v_resolve(hfsvol **vol, const char *path,
 	      if (parid)
 		*parid = data->u.dthd.thdParID;
 
-	      found = v_catsearch(*vol, data->u.dthd.thdParID,
-				  data->u.dthd.thdCName, data, fname, np);
+	      found = dlookup(*vol, data->u.dthd.thdParID,
+			      data->u.dthd.thdCName, data, fname, np);
 	      if (found == -1)
 		goto fail;
 	    }
@@ -866,7 +1778,7 @@ int v_resolve(hfsvol **vol, const char *path,
       if (parid)
 	*parid = dirid;
 
-      found = v_catsearch(*vol, dirid, name, data, fname, np);
+      found = dlookup(*vol, dirid, name, data, fname, np);
       if (found == -1)
 	goto fail;
 
@@ -1023,16 +1935,14 @@ fail:
  * DESCRIPTION:	set bits from an extent record in the volume bitmap
  */
 static
-void markexts(block *vbm, const ExtDataRec *exts)
+void markexts(hfsvol *vol, const ExtDataRec *exts)
 {
   int i;
-  unsigned int pt, len;
 
   for (i = 0; i < 3; ++i)
     {
-      for ( pt = (*exts)[i].xdrStABN,
-	   len = (*exts)[i].xdrNumABlks; len--; ++pt)
-	BMSET(vbm, pt);
+      bmfill(vol->vbm, (*exts)[i].xdrStABN, (*exts)[i].xdrNumABlks, 1);
+      vbmtouch(vol, (*exts)[i].xdrStABN, (*exts)[i].xdrNumABlks);
     }
 }
 
@@ -1044,7 +1954,7 @@ int v_scavenge(hfsvol *vol)
 {
   block *vbm = vol->vbm;
   node n;
-  unsigned int pt, blks;
+  unsigned int blks;
   unsigned long lastcnid = 15;
 
 # ifdef DEBUG
@@ -1067,8 +1977,8 @@ int v_scavenge(hfsvol *vol)
 
   /* begin by marking extents in MDB */
 
-  markexts(vbm, &vol->mdb.drXTExtRec);
-  markexts(vbm, &vol->mdb.drCTExtRec);
+  markexts(vol, &vol->mdb.drXTExtRec);
+  markexts(vol, &vol->mdb.drCTExtRec);
 
   vol->flags |= HFS_VOL_UPDATE_VBM;
 
@@ -1088,6 +1998,8 @@ int v_scavenge(hfsvol *vol)
 
 	  while (n.rnum >= n.nd.ndNRecs && n.nd.ndFLink > 0)
 	    {
+	      bt_prefetch(&vol->ext, n.nd.ndFLink);
+
 	      if (bt_getnode(&n, &vol->ext, n.nd.ndFLink) == -1)
 		goto fail;
 
@@ -1100,7 +2012,7 @@ int v_scavenge(hfsvol *vol)
 	  ptr = HFS_NODEREC(n, n.rnum);
 	  r_unpackextdata(HFS_RECDATA(ptr), &data);
 
-	  markexts(vbm, &data);
+	  markexts(vol, &data);
 
 	  ++n.rnum;
 	}
@@ -1122,6 +2034,8 @@ int v_scavenge(hfsvol *vol)
 
 	  while (n.rnum >= n.nd.ndNRecs && n.nd.ndFLink > 0)
 	    {
+	      bt_prefetch(&vol->cat, n.nd.ndFLink);
+
 	      if (bt_getnode(&n, &vol->cat, n.nd.ndFLink) == -1)
 		goto fail;
 
@@ -1137,8 +2051,8 @@ int v_scavenge(hfsvol *vol)
 	  switch (data.cdrType)
 	    {
 	    case cdrFilRec:
-	      markexts(vbm, &data.u.fil.filExtRec);
-	      markexts(vbm, &data.u.fil.filRExtRec);
+	      markexts(vol, &data.u.fil.filExtRec);
+	      markexts(vol, &data.u.fil.filRExtRec);
 
 	      if (data.u.fil.filFlNum > lastcnid)
 		lastcnid = data.u.fil.filFlNum;
@@ -1154,13 +2068,16 @@ int v_scavenge(hfsvol *vol)
 	}
     }
 
+  /* the bitmap was marked behind the free-run tree's back */
+
+  FREE(vol->ftree);
+
+  vol->ftree   = 0;
+  vol->ftreesz = 0;
+
   /* count free blocks */
 
-  for (blks = 0, pt = vol->mdb.drNmAlBlks; pt--; )
-    {
-      if (! BMTST(vbm, pt))
-	++blks;
-    }
+  blks = bmcount(vbm, vol->mdb.drNmAlBlks);
 
   if (vol->mdb.drFreeBks != blks)
     {
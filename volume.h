@@ -23,8 +23,15 @@
 
 void v_init(hfsvol *, int);
 
+void v_lock(hfsvol *);
+void v_unlock(hfsvol *);
+
 int v_open(hfsvol *, const char *, int);
 int v_flush(hfsvol *);
+
+int v_startwb(hfsvol *);
+void v_stopwb(hfsvol *);
+void v_kickwb(hfsvol *);
 int v_close(hfsvol *);
 
 int v_same(hfsvol *, const char *);
@@ -56,6 +63,7 @@ int v_putextrec(const ExtDataRec *, node *);
 int v_allocblocks(hfsvol *, ExtDescriptor *);
 int v_freeblocks(hfsvol *, const ExtDescriptor *);
 
+hfsvol *v_pathvol(hfsvol *, const char *);
 int v_resolve(hfsvol **, const char *, CatDataRec *, long *, char *, node *);
 
 int v_adjvalence(hfsvol *, unsigned long, int, int);